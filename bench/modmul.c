@@ -0,0 +1,102 @@
+/**
+ * @file
+ * @brief Microbenchmark of the modular multiplications of the BBP's kernel.
+ *
+ * For a 16-digit block n, the kernel computes 16^(16n - k) % (8k + m) for
+ * every k below 16n. We sample these exponentiations at a few depths and
+ * report the cost of a single modular multiplication, with the plain 128-bit
+ * modulo and with the Montgomery form.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "shared.h"
+#include "modular.h"
+
+/** The number of sampled exponentiations per depth. */
+#define SAMPLES (1 << 16)
+
+/** The denominator offset of the sampled series. */
+#define M 1
+
+/**
+ * @brief The previous modular exponentiation, with 128-bit modulos.
+ * @param pow the power of the exponentiation
+ * @param mod the modulo to apply on each step
+ * @return 16^pow % mod
+ */
+static uint64_t pow_mod_div(uint64_t pow, const uint64_t mod) {
+	u128 result = 1;
+	u128 base = 16 % mod;
+
+	while (pow > 0) {
+		if (pow & 1)
+			result = (result * base) % mod;
+
+		pow /= 2;
+		base = (base * base) % mod;
+	}
+
+	return (uint64_t)result;
+}
+
+/**
+ * @brief Gets the current time.
+ * @return the monotonic time in nanoseconds
+ */
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(void) {
+	const uint64_t depths[] = { 1000000ULL, 100000000ULL, 10000000000ULL };
+
+	printf("%-14s %14s %14s %10s\n", "n", "% (ns/mul)", "mont (ns/mul)", "speedup");
+
+	for (uint8_t d = 0; d < sizeof(depths) / sizeof(depths[0]); ++d) {
+		const uint64_t offset = BLOCK_SIZE * depths[d];
+		const uint64_t step = offset / SAMPLES;
+
+		uint64_t div_muls = 0, mont_muls = 0, checksum = 0;
+
+		double start = now();
+		for (uint64_t k = 0; k < offset; k += step) {
+			const uint64_t pow = offset - k;
+
+			// One squaring per bit, one multiplication per set bit.
+			div_muls += 64 - __builtin_clzll(pow) + __builtin_popcountll(pow);
+			checksum += pow_mod_div(pow, 8 * k + M);
+		}
+		const double div_time = now() - start;
+
+		start = now();
+		for (uint64_t k = 0; k < offset; k += step) {
+			const uint64_t pow = offset - k;
+
+			// One squaring per bit of 2^(4 pow), plus the reduction.
+			mont_muls += 64 - __builtin_clzll(4 * pow) + 1;
+			checksum -= pow_mod(pow, 8 * k + M);
+		}
+		const double mont_time = now() - start;
+
+		if (checksum != 0) {
+			fprintf(stderr, "[ERROR] Montgomery and modulo results differ\n");
+			return 1;
+		}
+
+		printf("%-14lu %14.2f %14.2f %9.2fx\n",
+				depths[d],
+				div_time / div_muls,
+				mont_time / mont_muls,
+				(div_time / SAMPLES) / (mont_time / SAMPLES));
+	}
+
+	return 0;
+}
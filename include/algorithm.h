@@ -4,11 +4,135 @@
  */
 
 #pragma once
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "shared.h"
+
+/**
+ * The number of hex digits a checking window is shifted by, relative to a
+ * block. It must be between 1 and BLOCK_SIZE - 1.
+ */
+#define WINDOW_SHIFT (BLOCK_SIZE / 2)
+
+/** The formulas that can compute the digits of $\pi$. */
+typedef enum {
+	/// The Bailey-Borwein-Plouffe formula.
+	ENGINE_BBP,
+
+	/// Bellard's formula, mathematically independent of the BBP's one and
+	/// cheaper per digit.
+	ENGINE_BELLARD,
+} engine;
+
+/**
+ * The instruction set variants of the kernels.
+ *
+ * Only the batch of modular exponentiations, where the series spend their
+ * time, has a variant per instruction set. The last few terms of a block,
+ * computed one by one with pow_mod(), and the __float128 sums are compiled
+ * for the baseline.
+ */
+typedef enum {
+	/// The best variant supported by the CPU.
+	ISA_AUTO,
+
+	/// Baseline x86-64.
+	ISA_BASELINE,
+
+	/// AVX2 and BMI2.
+	ISA_AVX2,
+
+	/// AVX-512 with the 52-bit integer multiply-adds (IFMA).
+	ISA_AVX512,
+} isa;
+
+/** The halves of two adjacent blocks confirmed by a shifted window. */
+typedef struct {
+	/// Whether the end of the block matches the window.
+	bool block;
+
+	/// Whether the start of the next block matches the window.
+	bool next;
+} window_check;
+
 /**
  * @brief Computes the n-th digits of $\pi$ in base 16.
  * @param n the offset to the 16-digit block to compute
  * @return a 16-digit block of pi digits
  */
 uint64_t pi(const uint64_t n);
+
+/**
+ * @brief Computes the n-th digits of $\pi$ in base 16 with a given formula.
+ * @param n the offset to the 16-digit block to compute
+ * @param e the formula to use
+ * @return a 16-digit block of pi digits
+ */
+uint64_t pi_engine(const uint64_t n, const engine e);
+
+/**
+ * @brief Computes consecutive 16-digit blocks of $\pi$ in base 16.
+ * @param first the offset to the first 16-digit block to compute
+ * @param count the number of blocks to compute
+ * @param out the count 16-digit blocks of pi digits
+ *
+ * This is much faster than count calls to pi(), as the modular powers are
+ * carried from a block to the next one.
+ */
+void pi_range(const uint64_t first, const uint64_t count, uint64_t * const out);
+
+/**
+ * @brief Computes 16 digits of $\pi$ in base 16, at any position.
+ * @param position the position of the first hex digit to compute
+ * @return 16 hex digits of pi, starting at the given position
+ */
+uint64_t pi_at(const uint64_t position);
+
+/**
+ * @brief Checks two adjacent blocks with a window shifted by WINDOW_SHIFT
+ * digits.
+ * @param n the offset to the first 16-digit block
+ * @param block the 16-digit block n
+ * @param next the 16-digit block n + 1
+ * @return which of the two blocks agree with the window
+ *
+ * As the window is computed at a different position, it does not repeat
+ * the computation of either block. A block whose two boundaries were
+ * confirmed has been entirely checked.
+ */
+window_check pi_check(const uint64_t n, const uint64_t block, const uint64_t next);
+
+/**
+ * @brief Computes the n-th digits of $\pi$ in base 16, with all the threads.
+ * @param n the offset to the 16-digit block to compute
+ * @return a 16-digit block of pi digits
+ *
+ * The k range of the single block is split across the OpenMP threads, which
+ * lowers the latency of a deep block. The result doesn't depend on the number
+ * of threads.
+ */
+uint64_t pi_parallel(const uint64_t n);
+
+/**
+ * @brief Forces the instruction set variant of the kernels.
+ * @param variant the variant to use, or ISA_AUTO for the best one
+ * @return the variant in use, which is the best supported one if the CPU
+ * cannot run the requested variant
+ *
+ * The variant is chosen at startup, so this is only needed to benchmark the
+ * variants. It must not be called while digits are being computed.
+ */
+isa pi_set_isa(const isa variant);
+
+/**
+ * @brief Computes the n-th digits of $\pi$ in base 16, and survives restarts.
+ * @param n the offset to the 16-digit block to compute
+ * @param path the path of the checkpoint file of this block
+ * @return a 16-digit block of pi digits
+ *
+ * The partial sums are periodically saved to the checkpoint file, and the
+ * computation resumes from it if it already holds this block. The file is
+ * removed once the block has been computed.
+ */
+uint64_t pi_checkpointed(const uint64_t n, const char * const path);
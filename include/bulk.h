@@ -0,0 +1,30 @@
+/**
+ * @file
+ * @brief Computes the first digits of pi at once, by binary splitting.
+ *
+ * Computing the first n blocks one by one with the BBP's formula is
+ * quadratic, while the Chudnovsky series summed by binary splitting is
+ * quasi-linear in the number of digits.
+ */
+
+#pragma once
+#include <stdint.h>
+
+#include "database.h"
+
+/**
+ * @brief Computes the first 16-digit blocks of $\pi$ in base 16.
+ * @param count the number of blocks to compute
+ * @param out the count first 16-digit blocks of pi digits
+ */
+void pi_prefix(const uint64_t count, uint64_t * const out);
+
+/**
+ * @brief Fills the first blocks of a database at once.
+ * @param db the database to fill
+ * @param count the number of blocks to fill
+ * @return only if the operation succeeded
+ *
+ * The blocks that are already computed are left untouched.
+ */
+db_return bulk_fill(database * const db, const uint64_t count);
@@ -0,0 +1,31 @@
+/**
+ * @file
+ * @brief CRC32C checksums, with the SSE 4.2 instruction when available.
+ *
+ * The checksums are raw: the register starts at the given value and is not
+ * inverted at the end. Starting from 0, the checksum is then linear, that is
+ * the checksum of A ^ B is the checksum of A ^ the checksum of B, so a
+ * checksum can be updated from the bytes that changed alone.
+ */
+
+#pragma once
+#include <stdint.h>
+
+/**
+ * @brief Computes the checksum of bytes.
+ * @param crc the checksum of the previous bytes, or 0
+ * @param bytes the bytes
+ * @param length the number of bytes
+ * @return the checksum of the previous bytes followed by bytes
+ */
+uint32_t crc32c(const uint32_t crc, const void * const bytes, const uint64_t length);
+
+/**
+ * @brief Appends zeros to a checksum.
+ * @param crc the checksum of some bytes
+ * @param length the number of zeros
+ * @return the checksum of the bytes followed by length zeros
+ *
+ * It takes a multiplication per bit of length, rather than a step per zero.
+ */
+uint32_t crc32c_shift(const uint32_t crc, const uint64_t length);
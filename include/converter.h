@@ -6,6 +6,8 @@
 #pragma once
 #include <stdint.h>
 
+#include "database.h"
+
 /**
  * @brief Converts a base 16 digit to a character.
  * @param digit the base 16 digit
@@ -16,8 +18,37 @@ char convert_digit(const uint8_t digit);
 /**
  * @brief Converts an array of base 16 digits to base 10.
  * @param n the number of digits to convert
- * @param digits the base 16 digits
- * @param length to store the length of the returned array
- * @return the array of base 10 digits
+ * @param digits the base 16 digits after the point
+ * @return the n first base 10 digits after the point, to free
+ *
+ * It takes the time of a multiplication and a radix conversion of numbers
+ * of n digits, which GMP does in a subquadratic time.
  */
 uint8_t *convert(const uint64_t n, const uint8_t * const digits);
+
+/**
+ * @brief Converts the first blocks of a database to base 10, into a file.
+ * @param db the database, whose blocks must be computed
+ * @param blocks the number of blocks to convert
+ * @param path the path of the file of the decimals
+ * @param budget the number of bytes of memory to use, roughly
+ * @return only if the operation succeeded, or DB_WRITE_FAIL if the file of
+ * the decimals or of the fraction could not be written
+ *
+ * The 16 * blocks first decimals after the point are written as characters,
+ * in order. The digits are read from the database a chunk at a time, and
+ * the fraction is kept between the passes in a file next to the output, so
+ * the memory does not grow with the number of digits. Each pass gives the
+ * decimals that fit in the budget, and reads and writes the whole fraction:
+ * the larger the budget, the fewer the passes.
+ *
+ * The passes are not divided and conquered, so the reads and writes grow as
+ * n^2 / budget for n decimals. It is meant for the conversions that do not
+ * fit in memory with convert(), with a budget of a fair part of it: when
+ * the fraction fits in the budget, it takes a single pass.
+ */
+db_return convert_database(
+		database * const db,
+		const uint64_t blocks,
+		const char * const path,
+		const uint64_t budget);
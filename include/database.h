@@ -49,6 +49,27 @@ typedef enum {
 
 	/// The block to write is outside the maximum wize of the database.
 	DB_WRITE_OUT_OF_BOUNDS,
+
+	/// The database cannot lock the file against the other processes.
+	DB_LOCK_FAIL,
+
+	/// The write cannot be made durable inside the journal.
+	DB_JOURNAL_FAIL,
+
+	/// The lease table cannot be opened, or holds too many leases.
+	DB_LEASE_FAIL,
+
+	/// The block to read does not match its checksum.
+	DB_READ_CORRUPTED,
+
+	/// The searched digits appear in no computed block.
+	DB_READ_NOT_FOUND,
+
+	/// A file the output goes through cannot be written, or read back.
+	DB_WRITE_FAIL,
+
+	/// The searched digits are not a hexadecimal string.
+	DB_READ_INVALID,
 } db_error;
 
 /** The returned value of all database functions. */
@@ -68,6 +89,18 @@ typedef struct {
 
 		/// Returned boolean.
 		bool boolean;
+
+		/// Returned number of blocks.
+		uint64_t count;
+
+		/// Returned range of blocks.
+		struct {
+			/// The position of the first block.
+			uint64_t position;
+
+			/// The number of blocks.
+			uint64_t count;
+		} range;
 	} value;
 } db_return;
 
@@ -79,6 +112,25 @@ typedef struct {
  */
 db_return db_create(const char * const path, const uint64_t max_digits);
 
+/**
+ * @brief Creates a database split into several files.
+ * @param path the path where to create the manifest
+ * @param max_digits the maximul number of digits inside the database
+ * @param segments the paths where to create the segments, one per disk,
+ * relative to the directory of the manifest unless they are absolute
+ * @param count the number of segments
+ * @return only if the operation succeeded
+ *
+ * Each segment holds a contiguous range of blocks and is a database of its
+ * own, so that the writes to different segments go to different disks in
+ * parallel. The manifest is then opened like any database.
+ */
+db_return db_create_sharded(
+		const char * const path,
+		const uint64_t max_digits,
+		const char * const * const segments,
+		const uint64_t count);
+
 /**
  * @brief Opens a database (it must exist).
  * @param path the path to a database
@@ -96,6 +148,13 @@ void db_close(database * const db);
  * @brief Migrates the database to have a bigger/smaller capacity.
  * @param db the database to migrate
  * @param size the new number of digits to allow inside the database
+ * @return only if the operation succeeded
+ *
+ * No other process may have the database open, and no block past the new
+ * capacity may be computed. The sections are moved in place, by chunks,
+ * and an interrupted migration is finished by the next db_open(). After a
+ * failure, the database must be opened again. A database split into
+ * several files cannot be migrated.
  */
 db_return db_migrate(database * const db, const uint64_t size);
 
@@ -113,6 +172,59 @@ db_return db_read_uncomputed(database * const db);
  */
 db_return db_read_unchecked(database * const db);
 
+/**
+ * @brief Verifies the checksum of every chunk of blocks.
+ * @param db the database to verify
+ * @return only if every chunk matches, else the first block of a chunk that
+ * does not
+ *
+ * It reads the whole database, so it is meant for a background thread. The
+ * reads verify the chunks they read once anyway.
+ */
+db_return db_scrub(database * const db);
+
+/**
+ * @brief Claims uncomputed blocks, so that no other worker gets them.
+ * @param db the database to query
+ * @param count the maximum number of blocks to claim
+ * @param ttl the number of seconds after which the claim expires
+ * @return the range of consecutive blocks claimed, at most count
+ *
+ * The blocks are leased until they are computed or the lease expires, and
+ * are then handed out again. The leases are shared by the processes.
+ */
+db_return db_claim_uncomputed(database * const db, const uint64_t count, const uint64_t ttl);
+
+/**
+ * @brief Gets the number of computed blocks.
+ * @param db the database to query
+ * @return the number of computed blocks, without scanning the bitmap
+ */
+db_return db_read_computed_count(database * const db);
+
+/**
+ * @brief Gets the number of checked blocks.
+ * @param db the database to query
+ * @return the number of checked blocks, without scanning the bitmap
+ */
+db_return db_read_checked_count(database * const db);
+
+/**
+ * @brief Gets the maximum number of blocks of the database.
+ * @param db the database to query
+ * @return the number of blocks the database can hold
+ */
+db_return db_read_capacity(database * const db);
+
+/**
+ * @brief Gets the first run of consecutive computed blocks.
+ * @param db the database to query
+ * @param start the position from which to search
+ * @return the range of computed blocks starting at or after start, as long
+ * as possible, or DB_READ_NOT_READY if there is none
+ */
+db_return db_read_computed_run(database * const db, const uint64_t start);
+
 /**
  * @brief Is the block at the given position computed?
  * @param db the database to query
@@ -137,6 +249,21 @@ db_return db_read_is_checked(database * const db, const uint64_t position);
  */
 db_return db_read(database * const db, const uint64_t position);
 
+/**
+ * @brief Reads consecutive blocks.
+ * @param db the database to query
+ * @param first the position of the first block
+ * @param count the number of blocks
+ * @param out the count 16-digit blocks
+ * @return only if every block of the range has been computed, and matches
+ * its checksum
+ */
+db_return db_read_range(
+		database * const db,
+		const uint64_t first,
+		const uint64_t count,
+		uint64_t * const out);
+
 /**
  * @brief Sets one computed block.
  * @param db the database to query
@@ -154,3 +281,42 @@ db_return db_write_computed(
  * @param position the block position
  */
 db_return db_write_checked(database * const db, const uint64_t position);
+
+/**
+ * @brief Sets consecutive computed blocks.
+ * @param db the database to query
+ * @param first the position of the first block
+ * @param count the number of blocks
+ * @param digits the count 16-digit blocks
+ * @return only if no block of the range has been computed yet, else the
+ * number of blocks written anyway
+ *
+ * The range is written as a whole or not at all, except over the segments
+ * of a sharded database: they are written one after the other, so the
+ * blocks of the segments before the one that failed are written.
+ *
+ * After DB_JOURNAL_FAIL, every later write fails the same way, and the
+ * database must be closed and opened again, which replays the journal.
+ */
+db_return db_write_range(
+		database * const db,
+		const uint64_t first,
+		const uint64_t count,
+		const uint64_t * const digits);
+
+/**
+ * @brief Sets consecutive blocks as checked.
+ * @param db the database to query
+ * @param first the position of the first block
+ * @param count the number of blocks
+ * @return only if no block of the range has been checked yet, else the
+ * number of blocks checked anyway
+ *
+ * As with db_write_range(), only the segments of a sharded database may be
+ * checked in part, and the database must be opened again after
+ * DB_JOURNAL_FAIL.
+ */
+db_return db_write_checked_range(
+		database * const db,
+		const uint64_t first,
+		const uint64_t count);
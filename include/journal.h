@@ -0,0 +1,127 @@
+/**
+ * @file
+ * @brief A write-ahead journal with group commit, for the database.
+ *
+ * The writes are appended to a sidecar file, and many writes share one
+ * fsync: the first writer to wait writes every pending record at once,
+ * while the others wait for it. Once the database file is synced itself,
+ * the journal is emptied.
+ */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/** A journal instance. */
+typedef struct journal_t journal;
+
+/** The kinds of journaled writes. */
+typedef enum {
+	/// Consecutive blocks computed, with their digits.
+	JOURNAL_COMPUTED = 1,
+
+	/// Consecutive blocks checked.
+	JOURNAL_CHECKED = 2,
+} journal_kind;
+
+/**
+ * @brief Applies a journaled write.
+ * @param context the context given to journal_replay()
+ * @param kind the kind of the write
+ * @param first the position of the first block
+ * @param count the number of blocks
+ * @param digits the count 16-digit blocks, if they were computed
+ * @return whether the write could be applied
+ */
+typedef bool (*journal_apply)(
+		void *context,
+		const journal_kind kind,
+		const uint64_t first,
+		const uint64_t count,
+		const uint64_t *digits);
+
+/**
+ * @brief Opens the journal of a database, creating it if needed.
+ * @param path the path to the database
+ * @return the journal, or NULL if it cannot be opened
+ */
+journal *journal_open(const char * const path);
+
+/**
+ * @brief Closes a journal.
+ * @param j the journal to close
+ */
+void journal_close(journal * const j);
+
+/**
+ * @brief Makes a write durable.
+ * @param j the journal
+ * @param kind the kind of the write
+ * @param first the position of the first block
+ * @param count the number of blocks
+ * @param digits the count 16-digit blocks, or NULL for checked blocks
+ * @return whether the write is durable
+ *
+ * It returns once the write is synced to the disk, with every other write
+ * committed meanwhile. Once a sync failed, every later write fails at once,
+ * and the database must be opened again.
+ */
+bool journal_commit(
+		journal * const j,
+		const journal_kind kind,
+		const uint64_t first,
+		const uint64_t count,
+		const uint64_t * const digits);
+
+/**
+ * @brief Applies every complete write of the journal again.
+ * @param j the journal
+ * @param apply the function to apply a write
+ * @param context the context given to apply
+ * @return whether every complete write was applied
+ *
+ * A torn write at the end of the journal, from a crash while committing,
+ * is ignored: it was not durable, so its writer did not succeed.
+ */
+bool journal_replay(journal * const j, const journal_apply apply, void * const context);
+
+/**
+ * @brief Gets the size of the journal.
+ * @param j the journal
+ * @return the number of bytes written in the journal, by every process
+ */
+uint64_t journal_size(journal * const j);
+
+/**
+ * @brief Takes the journal exclusively, if no other process has it open.
+ * @param j the journal
+ * @return whether this process is the only one to use the journal
+ */
+bool journal_acquire(journal * const j);
+
+/**
+ * @brief Shares the journal again, after journal_acquire().
+ * @param j the journal
+ */
+void journal_release(journal * const j);
+
+/**
+ * @brief Empties the journal.
+ * @param j the journal, without any write in progress in any process
+ * @return whether the journal was emptied
+ *
+ * The journaled writes must be durable inside the database.
+ */
+bool journal_truncate(journal * const j);
+
+/**
+ * @brief Empties the journal, once the database is durable.
+ * @param j the journal, without any write in progress
+ * @param sync the function to make the database durable
+ * @param context the context given to sync
+ * @return whether the journal was emptied
+ *
+ * The journal is shared with the other processes that opened the database,
+ * and is only emptied when no other process has it open.
+ */
+bool journal_checkpoint(journal * const j, bool (*sync)(void *), void * const context);
@@ -0,0 +1,251 @@
+/**
+ * @file
+ * @brief Modular arithmetic with Montgomery multiplications.
+ *
+ * A plain `(a * b) % mod` on 128-bit integers compiles to a library call
+ * (`__umodti3`), which dominates the BBP's algorithm. The Montgomery form
+ * trades this division for two 64-bit multiplications, once the modulo has
+ * been precomputed.
+ */
+
+#pragma once
+#include <stdint.h>
+
+/** A high-precision integer, to make the modular exponentiation faster. */
+typedef unsigned __int128 u128;
+
+/** The precomputed values for an odd modulo. */
+typedef struct {
+	/// The odd modulo.
+	uint64_t mod;
+
+	/// The inverse of the modulo, modulo 2^64.
+	uint64_t inverse;
+
+	/// 2^64 % mod, that is the number 1 in Montgomery form.
+	uint64_t one;
+} montgomery_t;
+
+/**
+ * @brief Inverts an odd number modulo 2^64.
+ * @param mod the odd number
+ * @return the inverse of mod, modulo 2^64
+ */
+static inline uint64_t montgomery_inverse(const uint64_t mod) {
+	// An odd number is its own inverse modulo 8, and each Newton iteration
+	// doubles the number of correct bits: 3, 6, 12, 24, 48, 96.
+	uint64_t inverse = mod;
+	for (uint8_t k = 0; k < 5; ++k)
+		inverse *= 2 - mod * inverse;
+
+	return inverse;
+}
+
+/**
+ * @brief Precomputes the Montgomery values for an odd modulo.
+ * @param mod the odd modulo
+ * @return the precomputed values
+ */
+static inline montgomery_t montgomery_init(const uint64_t mod) {
+	return (montgomery_t){
+		.mod = mod,
+		.inverse = montgomery_inverse(mod),
+		.one = -mod % mod,
+	};
+}
+
+/**
+ * @brief Montgomery reduction.
+ * @param t the number to reduce, lower than mod * 2^64
+ * @param m the precomputed modulo
+ * @return t / 2^64 % mod
+ */
+static inline uint64_t montgomery_reduce(const u128 t, const montgomery_t * const m) {
+	// q * mod has the same lower 64 bits as t, so the subtraction of the
+	// upper halves is exact.
+	const uint64_t q = (uint64_t)t * m->inverse;
+	const uint64_t high = (uint64_t)(t >> 64);
+	const uint64_t qmod = (uint64_t)(((u128)q * m->mod) >> 64);
+
+	return high >= qmod ? high - qmod : high - qmod + m->mod;
+}
+
+/**
+ * @brief Montgomery multiplication.
+ * @param a the first factor, in Montgomery form
+ * @param b the second factor, in Montgomery form
+ * @param m the precomputed modulo
+ * @return a * b in Montgomery form
+ */
+static inline uint64_t montgomery_mul(
+		const uint64_t a,
+		const uint64_t b,
+		const montgomery_t * const m) {
+	return montgomery_reduce((u128)a * b, m);
+}
+
+/**
+ * @brief Fast modular exponentiation of 2, for an odd modulo.
+ * @param pow the power of the exponentiation
+ * @param m the precomputed modulo, which must be below 2^63
+ * @return 2^pow % mod
+ */
+static inline uint64_t pow2_mod(const uint64_t pow, const montgomery_t * const m) {
+	if (pow == 0)
+		return 1 % m->mod;
+
+	// Left-to-right exponentiation: we square for each bit, and the
+	// multiplication by 2 is a modular doubling (the Montgomery form is
+	// linear). The modulo is below 2^63, thus doubling cannot overflow.
+	uint64_t result = m->one;
+	for (int8_t bit = 63 - __builtin_clzll(pow); bit >= 0; --bit) {
+		result = montgomery_mul(result, result, m);
+
+		// Branchless, as the bits of the power are unpredictable.
+		result <<= (pow >> bit) & 1;
+		result -= result >= m->mod ? m->mod : 0;
+	}
+
+	// We get out of the Montgomery form.
+	return montgomery_reduce(result, m);
+}
+
+/**
+ * @brief Fast modular exponentiation.
+ * @param pow the power of the exponentiation
+ * @param mod the modulo to apply on each step
+ * @return 16^pow % mod
+ *
+ * With mod = 2^s * q and q odd, 16^pow % mod = 2^s * (2^(4 pow - s) % q)
+ * as soon as 2^s divides 16^pow, so only an odd modulo is exponentiated.
+ */
+static inline uint64_t pow_mod(const uint64_t pow, const uint64_t mod) {
+	const uint8_t shift = __builtin_ctzll(mod);
+
+	// 16^pow is lower than 2^shift, and thus than the modulo.
+	if (4 * pow < shift)
+		return 1ULL << (4 * pow);
+
+	const montgomery_t m = montgomery_init(mod >> shift);
+	return pow2_mod(4 * pow - shift, &m) << shift;
+}
+
+/** The number of exponentiations computed in lockstep. */
+#define LANES 8
+
+/**
+ * @brief Modular exponentiations of 2 in lockstep, without SIMD.
+ * @param pow the LANES powers of the exponentiations
+ * @param mod the LANES odd modulos, which must be below 2^63
+ * @param out the LANES results 2^pow % mod
+ *
+ * Each exponentiation is a single chain of dependent multiplications, so
+ * interleaving independent lanes hides their latency.
+ */
+static inline void pow2_mod_lanes(
+		const uint64_t * const pow,
+		const uint64_t * const mod,
+		uint64_t * const out) {
+	montgomery_t m[LANES];
+	uint64_t result[LANES];
+	uint64_t bits = 0;
+
+	for (uint8_t l = 0; l < LANES; ++l) {
+		m[l] = montgomery_init(mod[l]);
+		result[l] = m[l].one;
+		bits |= pow[l];
+	}
+
+	// A lane with a shorter power squares 1 until its first bit.
+	for (int8_t bit = 63 - __builtin_clzll(bits | 1); bit >= 0; --bit) {
+		for (uint8_t l = 0; l < LANES; ++l) {
+			uint64_t r = montgomery_mul(result[l], result[l], &m[l]);
+			r <<= (pow[l] >> bit) & 1;
+			result[l] = r - (r >= m[l].mod ? m[l].mod : 0);
+		}
+	}
+
+	for (uint8_t l = 0; l < LANES; ++l)
+		out[l] = montgomery_reduce(result[l], &m[l]);
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+/** The radix of the Montgomery form with 52-bit multiply-adds. */
+#define IFMA_BITS 52
+
+/**
+ * The instruction sets of the 52-bit multiply-adds, so that they can be
+ * compiled whatever the target CPU, and only run if it supports them.
+ */
+#define IFMA_TARGET __attribute__((target("avx512f,avx512ifma")))
+
+/**
+ * @brief Montgomery multiplication on 52-bit lanes.
+ * @param a the first factors, in Montgomery form
+ * @param b the second factors, in Montgomery form
+ * @param mod the odd modulos, below 2^52
+ * @param inverse the opposite of the inverses of the modulos, modulo 2^52
+ * @return a * b / 2^52 % mod
+ */
+IFMA_TARGET static inline __m512i ifma_mul(
+		const __m512i a,
+		const __m512i b,
+		const __m512i mod,
+		const __m512i inverse) {
+	const __m512i zero = _mm512_setzero_si512();
+
+	const __m512i low = _mm512_madd52lo_epu64(zero, a, b);
+	const __m512i high = _mm512_madd52hi_epu64(zero, a, b);
+	const __m512i q = _mm512_madd52lo_epu64(zero, low, inverse);
+
+	// low + q * mod is a multiple of 2^52: either 0 or 2^52.
+	const __m512i carry =
+		_mm512_srli_epi64(_mm512_madd52lo_epu64(low, q, mod), IFMA_BITS);
+	const __m512i result =
+		_mm512_add_epi64(_mm512_madd52hi_epu64(high, q, mod), carry);
+
+	// The result is below 2 * mod: if it underflows, the minimum keeps it.
+	return _mm512_min_epu64(result, _mm512_sub_epi64(result, mod));
+}
+
+/**
+ * @brief Modular exponentiations of 2 in lockstep, on AVX-512 IFMA lanes.
+ * @param pow the LANES powers of the exponentiations
+ * @param mods the LANES odd modulos, which must be below 2^52
+ * @param out the LANES results 2^pow % mod
+ */
+IFMA_TARGET static inline void pow2_mod_ifma(
+		const uint64_t * const pow,
+		const uint64_t * const mods,
+		uint64_t * const out) {
+	const uint64_t mask = (1ULL << IFMA_BITS) - 1;
+	uint64_t inverses[LANES], ones[LANES];
+	uint64_t bits = 0;
+
+	for (uint8_t l = 0; l < LANES; ++l) {
+		inverses[l] = -montgomery_inverse(mods[l]) & mask;
+		ones[l] = (1ULL << IFMA_BITS) % mods[l];
+		bits |= pow[l];
+	}
+
+	const __m512i mod = _mm512_loadu_si512(mods);
+	const __m512i inverse = _mm512_loadu_si512(inverses);
+	const __m512i powers = _mm512_loadu_si512(pow);
+	__m512i result = _mm512_loadu_si512(ones);
+
+	for (int8_t bit = 63 - __builtin_clzll(bits | 1); bit >= 0; --bit) {
+		result = ifma_mul(result, result, mod, inverse);
+
+		const __mmask8 set =
+			_mm512_test_epi64_mask(powers, _mm512_set1_epi64(1ULL << bit));
+		result = _mm512_mask_add_epi64(result, set, result, result);
+		result = _mm512_min_epu64(result, _mm512_sub_epi64(result, mod));
+	}
+
+	// We get out of the Montgomery form.
+	result = ifma_mul(result, _mm512_set1_epi64(1), mod, inverse);
+	_mm512_storeu_si512(out, result);
+}
+#endif
@@ -0,0 +1,29 @@
+/**
+ * @file
+ * @brief Kernels over the digits of the blocks, with SSE2 when available.
+ */
+
+#pragma once
+#include <stdint.h>
+
+/** The number of values of a digit. */
+#define RADIX 16
+
+/** The number of bits of a digit. */
+#define NIBBLE 4
+
+/**
+ * @brief Unpacks blocks into one digit per byte.
+ * @param blocks the blocks
+ * @param count the number of blocks
+ * @param digits the 16 * count digits, in order
+ */
+void nibble_unpack(const uint64_t * const blocks, const uint64_t count, uint8_t * const digits);
+
+/**
+ * @brief Counts the occurrences of each digit.
+ * @param digits the digits, one per byte
+ * @param length the number of digits
+ * @param counts the counts of each digit, which are increased
+ */
+void nibble_count(const uint8_t * const digits, const uint64_t length, uint64_t counts[RADIX]);
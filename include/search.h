@@ -0,0 +1,64 @@
+/**
+ * @file
+ * @brief Finds where a string of hexadecimal digits first appears.
+ *
+ * An index, in a file of its own, holds the first position of every short
+ * string of digits, and a second file next to it, the path of the index
+ * followed by ".lists", holds the positions of the strings of 6 digits that
+ * start at an even position. Both are updated with the blocks computed since
+ * the last update, so they never read the same block twice. The short
+ * strings are then found with a lookup, and the longer ones by comparing the
+ * digits at the positions of their rarest listed substring only, without
+ * scanning the blocks.
+ *
+ * The lists take 8 bytes for every 2 digits, 8 times the size of the
+ * database, and a database of more than 2^41 digits cannot be indexed. The
+ * candidates of a long string are about the number of digits divided by
+ * 16^6, so a search compares some 60 positions per billion digits.
+ */
+
+#pragma once
+#include <stdint.h>
+
+#include "database.h"
+
+/** A search index over a database. */
+typedef struct search_t search;
+
+/**
+ * @brief Opens the index of a database, creating it if needed.
+ * @param db the database to index, which must stay open with the index
+ * @param path the path of the index
+ * @param index the index, if it could be opened
+ * @return only if the operation succeeded
+ */
+db_return search_open(database * const db, const char * const path, search ** const index);
+
+/**
+ * @brief Closes an index.
+ * @param index the index to close
+ */
+void search_close(search * const index);
+
+/**
+ * @brief Indexes the blocks computed since the last update.
+ * @param index the index to update
+ * @return the number of blocks newly indexed
+ *
+ * The updates are serialized between the threads and the processes. The
+ * searches of short strings go on meanwhile, and the longer ones wait while
+ * the lists are written.
+ */
+db_return search_update(search * const index);
+
+/**
+ * @brief Finds the first position of a string of digits.
+ * @param index the index to query, updated first
+ * @param hex the hexadecimal digits, lower or upper case
+ * @return the position of the first digit of the first occurrence, in
+ * digits, DB_READ_NOT_FOUND if the computed blocks do not hold it, or
+ * DB_READ_INVALID if the string is empty or not hexadecimal
+ *
+ * An occurrence may not span an uncomputed block.
+ */
+db_return search_find(search * const index, const char * const hex);
@@ -0,0 +1,159 @@
+/**
+ * @file
+ * @brief A database split into segment files, behind a manifest.
+ *
+ * Each segment is a database of its own, holding a contiguous range of
+ * blocks, so the segments can be put on different disks and written in
+ * parallel. The manifest lists the segments, and the db_* functions route
+ * each position to its segment when they are given a sharded database.
+ */
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "database.h"
+
+/** A sharded database. */
+typedef struct sharded_t sharded;
+
+/**
+ * @brief Tells whether a file starts like a manifest.
+ * @param magic_number the first 8 bytes of the file
+ * @return whether the file is a manifest
+ */
+bool shard_is_manifest(const uint8_t * const magic_number);
+
+/**
+ * @brief Creates a manifest and its segments.
+ * @param path the path of the manifest
+ * @param max_digits the maximum number of digits of the whole database
+ * @param segments the paths of the segments, relative to the directory of
+ * the manifest unless they are absolute
+ * @param count the number of segments
+ * @return only if the operation succeeded
+ */
+db_return shard_create(
+		const char * const path,
+		const uint64_t max_digits,
+		const char * const * const segments,
+		const uint64_t count);
+
+/**
+ * @brief Opens a manifest and its segments.
+ * @param path the path of the manifest
+ * @param shards the sharded database, if it could be opened
+ * @return only if the operation succeeded
+ */
+db_return shard_open(const char * const path, sharded ** const shards);
+
+/**
+ * @brief Closes a sharded database and its segments.
+ * @param shards the sharded database
+ */
+void shard_close(sharded * const shards);
+
+/**
+ * @brief Gets the position of the first block without a flag.
+ * @param shards the sharded database
+ * @param checked whether to look for unchecked blocks, else uncomputed ones
+ * @return the position of the block
+ */
+db_return shard_read_position(sharded * const shards, const bool checked);
+
+/**
+ * @brief Claims uncomputed blocks, inside a single segment.
+ * @param shards the sharded database
+ * @param count the maximum number of blocks to claim
+ * @param ttl the number of seconds after which the claim expires
+ * @return the range of consecutive blocks claimed
+ */
+db_return shard_claim_uncomputed(sharded * const shards, const uint64_t count, const uint64_t ttl);
+
+/**
+ * @brief Gets the number of blocks with a flag.
+ * @param shards the sharded database
+ * @param checked whether to count checked blocks, else computed ones
+ * @return the number of blocks of every segment
+ */
+db_return shard_read_count(sharded * const shards, const bool checked);
+
+/**
+ * @brief Gets the maximum number of blocks of the whole database.
+ * @param shards the sharded database
+ * @return the number of blocks of every segment
+ */
+db_return shard_read_capacity(sharded * const shards);
+
+/**
+ * @brief Gets the first run of consecutive computed blocks.
+ * @param shards the sharded database
+ * @param start the position from which to search
+ * @return the range of computed blocks, across the segments
+ */
+db_return shard_read_computed_run(sharded * const shards, const uint64_t start);
+
+/**
+ * @brief Verifies the checksums of every segment.
+ * @param shards the sharded database
+ * @return only if every chunk matches, else the first block of a chunk that
+ * does not
+ */
+db_return shard_scrub(sharded * const shards);
+
+/**
+ * @brief Reads the flag of a block.
+ * @param shards the sharded database
+ * @param position the position of the block
+ * @param checked whether to read the checked flag, else the computed one
+ * @return whether the block has its flag set
+ */
+db_return shard_read_flag(sharded * const shards, const uint64_t position, const bool checked);
+
+/**
+ * @brief Reads consecutive blocks.
+ * @param shards the sharded database
+ * @param first the position of the first block
+ * @param count the number of blocks
+ * @param out the count 16-digit blocks
+ * @return only if every block of the range has been computed
+ */
+db_return shard_read_range(
+		sharded * const shards,
+		const uint64_t first,
+		const uint64_t count,
+		uint64_t * const out);
+
+/**
+ * @brief Sets consecutive computed blocks.
+ * @param shards the sharded database
+ * @param first the position of the first block
+ * @param count the number of blocks
+ * @param digits the count 16-digit blocks
+ * @return only if no block of the range has been computed yet, else the
+ * number of blocks written before the segment that failed
+ *
+ * A range over several segments is written segment by segment, and stops
+ * at the first one that fails.
+ */
+db_return shard_write_range(
+		sharded * const shards,
+		const uint64_t first,
+		const uint64_t count,
+		const uint64_t * const digits);
+
+/**
+ * @brief Sets consecutive blocks as checked.
+ * @param shards the sharded database
+ * @param first the position of the first block
+ * @param count the number of blocks
+ * @return only if no block of the range has been checked yet, else the
+ * number of blocks checked before the segment that failed
+ *
+ * A range over several segments is written segment by segment, and stops
+ * at the first one that fails.
+ */
+db_return shard_write_checked_range(
+		sharded * const shards,
+		const uint64_t first,
+		const uint64_t count);
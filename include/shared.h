@@ -1,9 +1,33 @@
 /** Magic numbers. */
 
 #pragma once
+#include <stdint.h>
 
 /** The number of digits inside a unitary block. */
 #define BLOCK_SIZE 16
 
 /** The number of bits inside a byte. */
 #define BYTE 8
+
+/** Branchless programming to ceil N / M. */
+#define CEIL_DIV(N, M) (((N) + (M) - 1) / (M))
+
+/** The FNV-1a offset basis. */
+#define FNV_BASIS 0xCBF29CE484222325ULL
+
+/** The FNV-1a prime. */
+#define FNV_PRIME 0x100000001B3ULL
+
+/**
+ * @brief Hashes bytes with FNV-1a.
+ * @param hash the hash of the previous bytes, or FNV_BASIS
+ * @param bytes the bytes to hash
+ * @param length the number of bytes
+ * @return the hash of the previous bytes followed by bytes
+ */
+static inline uint64_t fnv(uint64_t hash, const void * const bytes, const uint64_t length) {
+	for (uint64_t k = 0; k < length; ++k)
+		hash = (hash ^ ((const uint8_t *)bytes)[k]) * FNV_PRIME;
+
+	return hash;
+}
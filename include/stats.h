@@ -0,0 +1,88 @@
+/**
+ * @file
+ * @brief Statistics of the digits, kept up to date with the database.
+ *
+ * The statistics of each range of blocks are kept in a file of their own,
+ * in a tree that also holds the statistics of the unions of ranges. They
+ * are updated with the ranges holding blocks computed since the last
+ * update, and any range of blocks is then summed from a few nodes.
+ */
+
+#pragma once
+#include <stdint.h>
+
+#include "database.h"
+#include "nibble.h"
+
+/** The statistics of a database. */
+typedef struct stats_t stats;
+
+/** A run of equal digits. */
+typedef struct {
+	/// The position of its first digit.
+	uint64_t position;
+
+	/// The number of digits.
+	uint64_t length;
+
+	/// The repeated digit.
+	uint8_t digit;
+} stats_run;
+
+/** The statistics of the computed digits of a range of blocks. */
+typedef struct {
+	/// The number of occurrences of each digit.
+	uint64_t counts[RADIX];
+
+	/// The number of computed digits.
+	uint64_t digits;
+
+	/// The first longest run, which uncomputed blocks interrupt.
+	stats_run longest;
+
+	/// The chi-square statistic of the counts, against a uniform law.
+	double chi_square;
+} stats_digits;
+
+/**
+ * @brief Opens the statistics of a database, creating them if needed.
+ * @param db the database, which must stay open with the statistics
+ * @param path the path of the statistics
+ * @param statistics the statistics, if they could be opened
+ * @return only if the operation succeeded
+ */
+db_return stats_open(database * const db, const char * const path, stats ** const statistics);
+
+/**
+ * @brief Closes statistics.
+ * @param statistics the statistics to close
+ */
+void stats_close(stats * const statistics);
+
+/**
+ * @brief Accounts for the blocks computed since the last update.
+ * @param statistics the statistics to update
+ * @return the number of blocks newly accounted for
+ *
+ * Only the ranges holding new blocks are read again. The updates are
+ * serialized between the threads and the processes, and the reads go on
+ * meanwhile.
+ */
+db_return stats_update(stats * const statistics);
+
+/**
+ * @brief Reads the statistics of consecutive blocks.
+ * @param statistics the statistics to query, updated first
+ * @param first the position of the first block
+ * @param count the number of blocks
+ * @param out the statistics of the computed blocks of the range
+ * @return only if the operation succeeded
+ *
+ * The whole ranges are read from the tree, and only the ranges cut by the
+ * bounds are read from the database.
+ */
+db_return stats_read(
+		stats * const statistics,
+		const uint64_t first,
+		const uint64_t count,
+		stats_digits * const out);
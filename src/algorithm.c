@@ -1,40 +1,600 @@
+#define _GNU_SOURCE
+
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <quadmath.h>
 
 #include "shared.h"
 #include "algorithm.h"
+#include "modular.h"
 
 /** A high-precision float number, to compute 10+ billion digits. */
 typedef __float128 f128;
 
-/** A high-precision integer, to make the modular exponentiation faster. */
-typedef unsigned __int128 u128;
-
 /** The precision of the fractions. */
 #define EPSILON ((f128)1e-34)
 
 /**
- * @brief Fast modular exponentiation.
- * @param pow the power of the exponentiation
- * @param mod the modulo to apply on each step
- * @return 16^pow % mod
+ * Whether the sums are carried as integer fixed-point fractions rather than
+ * as soft-float __float128 numbers. It can be overriden when compiling.
+ */
+#ifndef FIXED_POINT
+#define FIXED_POINT 1
+#endif
+
+/** The number of bits inside a fixed-point fraction. */
+#define FRACTION_BITS 128
+
+/**
+ * @brief Divides a shifted remainder.
+ * @param remainder the numerator, which must be lower than the denominator,
+ * replaced by remainder * 2^64 % denominator
+ * @param denominator the denominator
+ * @return floor(remainder * 2^64 / denominator)
+ *
+ * As the numerator is lower than the denominator, the quotient fits inside
+ * 64 bits, so a single hardware 128 by 64 bits division is enough.
+ */
+static inline uint64_t divide(uint64_t * const remainder, const uint64_t denominator) {
+#if defined(__x86_64__)
+	uint64_t quotient;
+
+	__asm__("divq %[d]"
+			: "=a"(quotient), "=d"(*remainder)
+			: "a"(0ULL), "d"(*remainder), [d] "rm"(denominator));
+
+	return quotient;
+#else
+	const u128 numerator = (u128)*remainder << 64;
+	*remainder = numerator % denominator;
+
+	return numerator / denominator;
+#endif
+}
+
+/**
+ * @brief Computes a fixed-point fraction.
+ * @param numerator the numerator, which must be lower than the denominator
+ * @param denominator the denominator
+ * @return floor(numerator * 2^128 / denominator)
+ */
+static inline u128 fraction(const uint64_t numerator, const uint64_t denominator) {
+	uint64_t remainder = numerator;
+
+	const uint64_t high = divide(&remainder, denominator);
+	const uint64_t low = divide(&remainder, denominator);
+
+	return ((u128)high << 64) | low;
+}
+
+/** A lockstep batch of LANES modular exponentiations of 2. */
+typedef void (*batch_t)(
+		const uint64_t * const pow,
+		const uint64_t * const mod,
+		uint64_t * const out);
+
+/**
+ * @brief Modular exponentiations of 2 in lockstep, for baseline x86-64.
+ * @param pow the LANES powers of the exponentiations
+ * @param mod the LANES odd modulos, which must be below 2^63
+ * @param out the LANES results 2^pow % mod
+ */
+static void batch_baseline(
+		const uint64_t * const pow,
+		const uint64_t * const mod,
+		uint64_t * const out) {
+	pow2_mod_lanes(pow, mod, out);
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief Modular exponentiations of 2 in lockstep, for AVX2 CPUs.
+ * @param pow the LANES powers of the exponentiations
+ * @param mod the LANES odd modulos, which must be below 2^63
+ * @param out the LANES results 2^pow % mod
+ *
+ * There is no 64-bit vector multiplication before AVX-512, but these CPUs
+ * also have the BMI2 flag-less multiplications and shifts.
+ */
+__attribute__((target("avx2,bmi2")))
+static void batch_avx2(
+		const uint64_t * const pow,
+		const uint64_t * const mod,
+		uint64_t * const out) {
+	pow2_mod_lanes(pow, mod, out);
+}
+
+/**
+ * @brief Modular exponentiations of 2 in lockstep, for AVX-512 IFMA CPUs.
+ * @param pow the LANES powers of the exponentiations
+ * @param mod the LANES odd modulos, which must be below 2^63
+ * @param out the LANES results 2^pow % mod
+ */
+IFMA_TARGET
+static void batch_avx512(
+		const uint64_t * const pow,
+		const uint64_t * const mod,
+		uint64_t * const out) {
+	uint64_t bits = 0;
+	for (uint8_t l = 0; l < LANES; ++l)
+		bits |= mod[l];
+
+	// The 52-bit lanes only fit the modulos below 2^52.
+	if (bits >> IFMA_BITS == 0)
+		pow2_mod_ifma(pow, mod, out);
+	else
+		pow2_mod_lanes(pow, mod, out);
+}
+#endif
+
+/** The kernels of each instruction set variant. */
+static const batch_t batches[] = {
+	[ISA_BASELINE] = batch_baseline,
+#if defined(__x86_64__)
+	[ISA_AVX2] = batch_avx2,
+	[ISA_AVX512] = batch_avx512,
+#endif
+};
+
+/** The names of the instruction set variants, to force one. */
+static const char * const isa_names[] = {
+	[ISA_AUTO] = "auto",
+	[ISA_BASELINE] = "baseline",
+	[ISA_AVX2] = "avx2",
+	[ISA_AVX512] = "avx512",
+};
+
+/** The environment variable to force an instruction set variant. */
+#define ISA_VARIABLE "PI_ISA"
+
+/** The kernel of the instruction set variant in use. */
+static batch_t pow2_mod_batch = batch_baseline;
+
+/**
+ * @brief Detects the best instruction set variant supported by the CPU.
+ * @return the best variant
+ */
+static isa isa_detect(void) {
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f")
+			&& __builtin_cpu_supports("avx512ifma"))
+		return ISA_AVX512;
+
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+		return ISA_AVX2;
+#endif
+
+	return ISA_BASELINE;
+}
+
+isa pi_set_isa(const isa variant) {
+	const isa best = isa_detect();
+
+	// A variant the CPU cannot run falls back to the best one it can.
+	const isa chosen = variant == ISA_AUTO || variant > best ? best : variant;
+	pow2_mod_batch = batches[chosen];
+
+	return chosen;
+}
+
+/**
+ * @brief Selects the instruction set variant at startup.
+ *
+ * The best variant is chosen with cpuid, unless the PI_ISA environment
+ * variable forces one (auto, baseline, avx2 or avx512). An unknown name is
+ * reported, and the best variant is used.
+ */
+__attribute__((constructor))
+static void isa_init(void) {
+	const char * const forced = getenv(ISA_VARIABLE);
+	bool known = forced == NULL;
+	isa variant = ISA_AUTO;
+
+	if (forced != NULL)
+		for (uint8_t v = ISA_AUTO; v <= ISA_AVX512; ++v)
+			if (strcmp(forced, isa_names[v]) == 0) {
+				variant = v;
+				known = true;
+			}
+
+	if (!known)
+		fprintf(stderr, "[WARNING] Unknown %s '%s', expected auto, baseline, avx2 or avx512\n",
+			ISA_VARIABLE, forced);
+
+	pi_set_isa(variant);
+}
+
+#if FIXED_POINT
+/** The number of series inside the BBP's formula. */
+#define SERIES 4
+
+/** The denominator offsets of the four series. */
+static const uint8_t offsets[SERIES] = { 1, 4, 5, 6 };
+
+/** The number of k evaluated by a thread at once, within a single block. */
+#define CHUNK (1ULL << 16)
+
+/**
+ * @brief Adds the low-precision remainders of the four fraction sums.
+ * @param n the n-th digit to compute
+ * @param sums the four sums, as 128-bit fractions
+ */
+static inline void remainders(const uint64_t n, u128 * const sums) {
+	// 16^(n - k) is the same right shift of 4 bits per step for the four
+	// series, until the whole fraction has been shifted out.
+	// When the denominator is 1, the term is an integer, so its decimal part
+	// is null.
+	for (uint64_t k = n; 4 * (k - n) < FRACTION_BITS; ++k) {
+		const uint8_t power = 4 * (k - n);
+
+		for (uint8_t s = 0; s < SERIES; ++s) {
+			const uint64_t denominator = 8 * k + offsets[s];
+			sums[s] += fraction(1 % denominator, denominator) >> power;
+		}
+	}
+}
+
+/**
+ * @brief Combines the four fraction sums into a 16-digit block.
+ * @param sums the four sums, as 128-bit fractions
+ * @return the 16-digit block
+ */
+static inline uint64_t combine(const u128 * const sums) {
+	const u128 digit =
+		  4 * sums[0]
+		- 2 * sums[1]
+		-	  sums[2]
+		-	  sums[3];
+
+	// The 16 hex digits are the upper 64 bits of the decimal part, already
+	// packed two per byte with the first digit in the upper bits.
+	return (uint64_t)(digit >> (FRACTION_BITS - BYTE * sizeof(uint64_t)));
+}
+
+/**
+ * @brief Adds the high-precision part of the four fraction sums, in a single
+ * pass, with integer operations only.
+ * @param n the n-th digit to compute
+ * @param begin the first k to add
+ * @param end the k to stop at, at most n
+ * @param sums the four sums, as 128-bit fractions
+ *
+ * The fractions are only kept modulo 1, which the wrapping of the unsigned
+ * 128-bit additions gives us for free. This also makes the additions
+ * associative, so the k can be split in any way without changing the sums.
+ */
+static void series(
+		const uint64_t n,
+		const uint64_t begin,
+		const uint64_t end,
+		u128 * const sums) {
+	uint64_t k;
+
+	// The denominator 8k + m is 2^shift times an odd number, and
+	// 16^(n - k) % (8k + m) / (8k + m) is the same fraction as
+	// 2^(4(n - k) - shift) % odd / odd.
+	// Thus, the four series of a given k share the same exponent schedule,
+	// up to their last bits, and run in lockstep lanes.
+	for (k = begin; k + LANES / SERIES <= end; k += LANES / SERIES) {
+		uint64_t pows[LANES], mods[LANES], residues[LANES];
+
+		for (uint8_t l = 0; l < LANES; ++l) {
+			const uint64_t j = k + l / SERIES;
+			const uint8_t m = offsets[l % SERIES];
+			const uint8_t shift = __builtin_ctz(m);
+
+			pows[l] = 4 * (n - j) - shift;
+			mods[l] = (8 * j + m) >> shift;
+		}
+
+		pow2_mod_batch(pows, mods, residues);
+
+		for (uint8_t l = 0; l < LANES; ++l)
+			sums[l % SERIES] += fraction(residues[l], mods[l]);
+	}
+
+	// High-precision part, for the last k.
+	for (; k < end; ++k) {
+		for (uint8_t s = 0; s < SERIES; ++s) {
+			const uint64_t denominator = 8 * k + offsets[s];
+			sums[s] += fraction(pow_mod(n - k, denominator), denominator);
+		}
+	}
+}
+
+/**
+ * @brief Computes 16 digits of $\pi$ with the BBP's formula.
+ * @param offset the position of the first hex digit to compute
+ * @return 16 hex digits of pi
+ */
+static uint64_t bbp(const uint64_t offset) {
+	u128 sums[SERIES] = { 0 };
+
+	series(offset, 0, offset, sums);
+	remainders(offset, sums);
+
+	return combine(sums);
+}
+
+/**
+ * @brief Adds the high-precision part of the four fraction sums, with all
+ * the threads.
+ * @param n the n-th digit to compute
+ * @param begin the first k to add
+ * @param end the k to stop at, at most n
+ * @param sums the four sums, as 128-bit fractions
+ */
+static void series_parallel(
+		const uint64_t n,
+		const uint64_t begin,
+		const uint64_t end,
+		u128 * const sums) {
+	const uint64_t chunks = CEIL_DIV(end - begin, CHUNK);
+
+	// Each thread adds its chunks to its own sums. As the additions wrap
+	// modulo 2^128, the reduction gives the same sums whatever the number of
+	// threads and the order they finish in.
+#pragma omp parallel
+	{
+		u128 partial[SERIES] = { 0 };
+
+#pragma omp for schedule(dynamic)
+		for (uint64_t c = 0; c < chunks; ++c) {
+			const uint64_t first = begin + c * CHUNK;
+			series(n, first, first + CHUNK < end ? first + CHUNK : end, partial);
+		}
+
+#pragma omp critical
+		for (uint8_t s = 0; s < SERIES; ++s)
+			sums[s] += partial[s];
+	}
+}
+
+uint64_t pi_parallel(const uint64_t n) {
+	const uint64_t offset = BLOCK_SIZE * n;
+	u128 sums[SERIES] = { 0 };
+
+	series_parallel(offset, 0, offset, sums);
+	remainders(offset, sums);
+
+	return combine(sums);
+}
+
+#pragma pack(push, 1)
+/** The partial state of a single block, saved to a checkpoint file. */
+typedef struct {
+	/// Checkpoint magic number.
+	uint8_t magic_number[8];
+
+	/// Checkpoint version.
+	uint8_t version;
+
+	/// The position of the first hex digit of the block.
+	uint64_t offset;
+
+	/// The next k to add to the sums.
+	uint64_t k;
+
+	/// The four partial sums.
+	u128 sums[SERIES];
+} checkpoint_t;
+#pragma pack(pop)
+
+/** The checkpoint magic number. */
+#define CHECKPOINT_MAGIC "PiCP\x24\x3F\x6A\x88"
+
+/** The checkpoint version. */
+#define CHECKPOINT_VERSION 1
+
+/** The number of k between two looks at the clock. */
+#define CHECKPOINT_STEP (1ULL << 24)
+
+/** The minimum number of seconds between two checkpoints. */
+#define CHECKPOINT_SECONDS 60
+
+/** The suffix of the temporary file a checkpoint is written to. */
+#define CHECKPOINT_SUFFIX ".tmp"
+
+/**
+ * @brief Syncs the directory of a file, so that its renaming is durable.
+ * @param path the path of the file
+ * @return whether the directory is durable
+ */
+static bool checkpoint_sync_directory(const char * const path) {
+	const char * const slash = strrchr(path, '/');
+	const size_t length = slash == NULL ? 0 : slash == path ? 1 : (size_t)(slash - path);
+
+	char directory[length + 2];
+	if (slash == NULL) {
+		strcpy(directory, ".");
+	} else {
+		memcpy(directory, path, length);
+		directory[length] = 0;
+	}
+
+	const int fd = open(directory, O_RDONLY | O_DIRECTORY);
+	if (fd == -1)
+		return false;
+
+	const bool synced = fsync(fd) == 0;
+	close(fd);
+
+	return synced;
+}
+
+/**
+ * @brief Saves the partial state of a block.
+ * @param path the path of the checkpoint file
+ * @param checkpoint the state to save
+ * @return whether the checkpoint has been saved
+ *
+ * The state is written to a temporary file which then replaces the previous
+ * checkpoint, so that a crash while writing never loses it. The directory
+ * is synced after the replacement, which is not durable before.
+ */
+static bool checkpoint_save(const char * const path, const checkpoint_t * const checkpoint) {
+	char *tmp = (char *)malloc(strlen(path) + sizeof(CHECKPOINT_SUFFIX));
+	if (tmp == NULL)
+		return false;
+
+	strcpy(tmp, path);
+	strcat(tmp, CHECKPOINT_SUFFIX);
+
+	bool saved = false;
+	FILE *file = fopen(tmp, "wb");
+	if (file != NULL) {
+		saved = fwrite(checkpoint, sizeof(*checkpoint), 1, file) == 1
+			&& fflush(file) == 0
+			&& fsync(fileno(file)) == 0;
+		saved = fclose(file) == 0 && saved;
+		saved = saved && rename(tmp, path) == 0 && checkpoint_sync_directory(path);
+	}
+
+	free(tmp);
+	return saved;
+}
+
+/**
+ * @brief Loads the partial state of a block.
+ * @param path the path of the checkpoint file
+ * @param offset the position of the first hex digit of the block
+ * @param checkpoint the loaded state
+ * @return whether a checkpoint of this block has been loaded
  */
-static uint64_t pow_mod(uint64_t pow, const uint64_t mod) {
-	u128 result = 1;
-	u128 base = 16 % mod;
+static bool checkpoint_load(
+		const char * const path,
+		const uint64_t offset,
+		checkpoint_t * const checkpoint) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return false;
+
+	const bool read = fread(checkpoint, sizeof(*checkpoint), 1, file) == 1;
+	fclose(file);
+
+	return read
+		&& memcmp(checkpoint->magic_number, CHECKPOINT_MAGIC, 8) == 0
+		&& checkpoint->version == CHECKPOINT_VERSION
+		&& checkpoint->offset == offset
+		&& checkpoint->k <= offset;
+}
 
-	while (pow > 0) {
-		if (pow & 1)
-			result = (result * base) % mod;
+uint64_t pi_checkpointed(const uint64_t n, const char * const path) {
+	const uint64_t offset = BLOCK_SIZE * n;
 
-		pow /= 2;
-		base = (base * base) % mod;
+	checkpoint_t checkpoint;
+	if (!checkpoint_load(path, offset, &checkpoint)) {
+		memset(&checkpoint, 0, sizeof(checkpoint));
+		memcpy(checkpoint.magic_number, CHECKPOINT_MAGIC, 8);
+		checkpoint.version = CHECKPOINT_VERSION;
+		checkpoint.offset = offset;
 	}
 
-	return (uint64_t)result;
+	// The sums are only saved every so often, and never on a partial step,
+	// so that the saved k and sums always match.
+	time_t last = time(NULL);
+	while (checkpoint.k < offset) {
+		const uint64_t end = offset - checkpoint.k > CHECKPOINT_STEP
+			? checkpoint.k + CHECKPOINT_STEP
+			: offset;
+
+		series_parallel(offset, checkpoint.k, end, checkpoint.sums);
+		checkpoint.k = end;
+
+		if (end < offset && time(NULL) - last >= CHECKPOINT_SECONDS) {
+			// A failed checkpoint only costs the ability to resume.
+			checkpoint_save(path, &checkpoint);
+			last = time(NULL);
+		}
+	}
+
+	remainders(offset, checkpoint.sums);
+	remove(path);
+
+	return combine(checkpoint.sums);
 }
 
+void pi_range(const uint64_t first, const uint64_t count, uint64_t * const out) {
+	if (count == 0)
+		return;
+
+	// The four sums of every block.
+	u128 *sums = (u128 *)calloc(count * SERIES, sizeof(u128));
+	if (sums == NULL) {
+		for (uint64_t j = 0; j < count; ++j)
+			out[j] = bbp(BLOCK_SIZE * (first + j));
+		return;
+	}
+
+	const uint64_t offset = BLOCK_SIZE * first;
+	const uint64_t last = BLOCK_SIZE * (first + count - 1);
+
+	// For a given k, going from block j to block j + 1 multiplies the power
+	// by 16^16 = 2^64. So the next residue, 2^64 * residue % mod, is the
+	// remainder of the division that gives the upper half of the fraction:
+	// once exponentiated for its first block, each k costs a single division
+	// per block.
+	for (uint64_t k = 0; k < last; k += LANES / SERIES) {
+		uint64_t pows[LANES], mods[LANES], residues[LANES], firsts[LANES];
+
+		for (uint8_t l = 0; l < LANES; ++l) {
+			const uint64_t j = k + l / SERIES;
+			const uint8_t m = offsets[l % SERIES];
+			const uint8_t shift = __builtin_ctz(m);
+
+			// The first block for which k is in the high-precision part.
+			firsts[l] = j < offset ? 0 : j / BLOCK_SIZE - first + 1;
+
+			pows[l] = 4 * (offset + BLOCK_SIZE * firsts[l] - j) - shift;
+			mods[l] = (8 * j + m) >> shift;
+
+			// This k is past the high-precision part of every block.
+			if (j >= last)
+				pows[l] = 0, mods[l] = 1;
+		}
+
+		pow2_mod_batch(pows, mods, residues);
+
+		// The four series of a given k are independent chains of divisions,
+		// so they are interleaved.
+		for (uint8_t l = 0; l < LANES; l += SERIES) {
+			if (k + l / SERIES >= last)
+				continue;
+
+			u128 * const sum = &sums[SERIES * firsts[l]];
+			uint64_t * const residue = &residues[l];
+			const uint64_t * const mod = &mods[l];
+			uint64_t high[SERIES];
+
+			for (uint8_t s = 0; s < SERIES; ++s)
+				high[s] = divide(&residue[s], mod[s]);
+
+			for (uint64_t j = 0; j < count - firsts[l]; ++j) {
+				for (uint8_t s = 0; s < SERIES; ++s) {
+					const uint64_t low = divide(&residue[s], mod[s]);
+					sum[SERIES * j + s] += ((u128)high[s] << 64) | low;
+					high[s] = low;
+				}
+			}
+		}
+	}
+
+	for (uint64_t j = 0; j < count; ++j) {
+		remainders(offset + BLOCK_SIZE * j, &sums[SERIES * j]);
+		out[j] = combine(&sums[SERIES * j]);
+	}
+
+	free(sums);
+}
+#else
 /**
  * @brief Computes a single fraction sum.
  * @param n the n-th digit to compute
@@ -79,8 +639,12 @@ static f128 sn(const uint64_t n, const uint8_t m) {
 	return sum;
 }
 
-uint64_t pi(const uint64_t n) {
-	const uint64_t offset = 16ULL * n;
+/**
+ * @brief Computes 16 digits of $\pi$ with the BBP's formula.
+ * @param offset the position of the first hex digit to compute
+ * @return 16 hex digits of pi
+ */
+static uint64_t bbp(const uint64_t offset) {
 
 	f128 digit =
 		  4.0Q * sn(offset, 1)
@@ -113,3 +677,171 @@ uint64_t pi(const uint64_t n) {
 
 	return ret;
 }
+
+void pi_range(const uint64_t first, const uint64_t count, uint64_t * const out) {
+	for (uint64_t j = 0; j < count; ++j)
+		out[j] = bbp(BLOCK_SIZE * (first + j));
+}
+
+uint64_t pi_parallel(const uint64_t n) {
+	// The floating-point sums are not associative, so splitting them would
+	// not be reproducible.
+	return bbp(BLOCK_SIZE * n);
+}
+
+uint64_t pi_checkpointed(const uint64_t n, const char * const path) {
+	// Only the fixed-point sums are saved to checkpoints.
+	(void)path;
+	return bbp(BLOCK_SIZE * n);
+}
+#endif
+
+/** The number of terms inside Bellard's formula. */
+#define TERMS 7
+
+/** A term (-1)^k * sign * 2^(power - 10k) / (a * k + b) of Bellard's formula. */
+typedef struct {
+	/// The factor of k in the denominator.
+	uint8_t a;
+
+	/// The offset of the denominator.
+	uint8_t b;
+
+	/// The power of 2 in the numerator.
+	uint8_t power;
+
+	/// Whether the term is subtracted.
+	bool negative;
+} term_t;
+
+/**
+ * The terms of Bellard's formula, once the whole sum has been divided
+ * by 2^6.
+ */
+static const term_t terms[TERMS] = {
+	{ .a = 4, .b = 1, .power = 5, .negative = true },
+	{ .a = 4, .b = 3, .power = 0, .negative = true },
+	{ .a = 10, .b = 1, .power = 8, .negative = false },
+	{ .a = 10, .b = 3, .power = 6, .negative = true },
+	{ .a = 10, .b = 5, .power = 2, .negative = true },
+	{ .a = 10, .b = 7, .power = 2, .negative = true },
+	{ .a = 10, .b = 9, .power = 0, .negative = false },
+};
+
+/** The overall power of 2 dividing Bellard's formula. */
+#define BELLARD_SHIFT 6
+
+/**
+ * @brief Computes 16 digits of $\pi$ with Bellard's formula.
+ * @param offset the position of the first hex digit to compute
+ * @return 16 hex digits of pi
+ *
+ * Multiplying by 16^offset, the term (k, t) is 2^e / d with
+ * e = 4 offset - 6 + power - 10k. All the denominators are odd, so the terms
+ * with e >= 0 are 2^e % d / d, and the others are right shifts of 1 / d.
+ * The sum is kept as a 128-bit fixed-point fraction modulo 1.
+ */
+static uint64_t bellard(const uint64_t offset) {
+	const int64_t exponent = 4 * offset - BELLARD_SHIFT;
+	u128 sum = 0;
+	int64_t k;
+
+	// Every exponent of the first k is non-negative, so the terms are
+	// flattened and evaluated in lockstep lanes.
+	const uint64_t head = exponent >= 0 ? TERMS * (exponent / 10 + 1) : 0;
+
+	uint64_t i;
+	for (i = 0; i + LANES <= head; i += LANES) {
+		uint64_t pows[LANES], mods[LANES], residues[LANES];
+
+		for (uint8_t l = 0; l < LANES; ++l) {
+			const uint64_t j = (i + l) / TERMS;
+			const term_t * const term = &terms[(i + l) % TERMS];
+
+			pows[l] = exponent + term->power - 10 * j;
+			mods[l] = term->a * j + term->b;
+		}
+
+		pow2_mod_batch(pows, mods, residues);
+
+		for (uint8_t l = 0; l < LANES; ++l) {
+			const uint64_t j = (i + l) / TERMS;
+			const u128 value = fraction(residues[l], mods[l]);
+
+			if (terms[(i + l) % TERMS].negative ^ (j & 1))
+				sum -= value;
+			else
+				sum += value;
+		}
+	}
+
+	// The last terms are evaluated one by one, until every one of them has
+	// been shifted out of the fraction.
+	uint8_t t = i % TERMS;
+	for (k = i / TERMS;; ++k, t = 0) {
+		bool shifted_out = true;
+
+		for (; t < TERMS; ++t) {
+			const term_t * const term = &terms[t];
+			const int64_t power = exponent + term->power - 10 * k;
+			const uint64_t denominator = term->a * k + term->b;
+			u128 value;
+
+			if (power >= 0) {
+				const montgomery_t m = montgomery_init(denominator);
+				value = fraction(pow2_mod(power, &m), denominator);
+			} else if (power > -FRACTION_BITS) {
+				// 1 / 1 is the only fraction with an integer part.
+				value = denominator == 1
+					? (u128)1 << (FRACTION_BITS + power)
+					: fraction(1, denominator) >> -power;
+			} else {
+				continue;
+			}
+
+			shifted_out = false;
+			if (term->negative ^ (k & 1))
+				sum -= value;
+			else
+				sum += value;
+		}
+
+		if (shifted_out)
+			break;
+	}
+
+	return (uint64_t)(sum >> (FRACTION_BITS - BYTE * sizeof(uint64_t)));
+}
+
+uint64_t pi_engine(const uint64_t n, const engine e) {
+	switch (e) {
+		case ENGINE_BELLARD:
+			return bellard(BLOCK_SIZE * n);
+
+		case ENGINE_BBP:
+		default:
+			return bbp(BLOCK_SIZE * n);
+	}
+}
+
+uint64_t pi(const uint64_t n) {
+	return pi_engine(n, ENGINE_BBP);
+}
+
+uint64_t pi_at(const uint64_t position) {
+	return bbp(position);
+}
+
+window_check pi_check(const uint64_t n, const uint64_t block, const uint64_t next) {
+	const uint64_t window = pi_at(BLOCK_SIZE * n + WINDOW_SHIFT);
+
+	// The window starts with the last BLOCK_SIZE - WINDOW_SHIFT digits of
+	// the block, and ends with the first WINDOW_SHIFT digits of the next one.
+	const uint8_t shift = 4 * WINDOW_SHIFT;
+	const uint8_t remaining = 4 * (BLOCK_SIZE - WINDOW_SHIFT);
+
+	return (window_check){
+		.block = window >> shift == (block << shift) >> shift,
+		.next = window << remaining == next >> remaining << remaining,
+	};
+}
@@ -0,0 +1,198 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <gmp.h>
+
+#include "shared.h"
+#include "bulk.h"
+
+/*
+ * The Chudnovsky formula:
+ *
+ *   1 / pi = 12 / C^(3/2) * sum (-1)^k (6k)! (A + B k) / ((3k)! (k!)^3 C^(3k))
+ *
+ * The ratio between two consecutive terms is a ratio of small polynomials
+ * in k, so the sum over [a, b) is computed as P(a, b), Q(a, b), T(a, b) by
+ * splitting the range in two halves, with integer operations only. Then:
+ *
+ *   pi = 426880 * sqrt(10005) * Q(0, n) / T(0, n)
+ */
+
+/** The constant term of the Chudnovsky series. */
+#define CHUDNOVSKY_A 13591409
+
+/** The linear term of the Chudnovsky series. */
+#define CHUDNOVSKY_B 545140134
+
+/** C^3 / 24, with C = 640320. */
+#define CHUDNOVSKY_C3_24 10939058860032000ULL
+
+/** The number of bits each term of the series adds, rounded down. */
+#define BITS_PER_TERM 47
+
+/** The extra bits computed to absorb the truncation errors. */
+#define GUARD_BITS 64
+
+/**
+ * @brief Sums the Chudnovsky series by binary splitting.
+ * @param a the first term
+ * @param b the term to stop at
+ * @param p P(a, b)
+ * @param q Q(a, b)
+ * @param t T(a, b)
+ */
+static void split(const uint64_t a, const uint64_t b, mpz_t p, mpz_t q, mpz_t t) {
+	if (b - a == 1) {
+		if (a == 0) {
+			mpz_set_ui(p, 1);
+			mpz_set_ui(q, 1);
+		} else {
+			// P = -(6a - 5)(2a - 1)(6a - 1)
+			mpz_set_ui(p, 6 * a - 5);
+			mpz_mul_ui(p, p, 2 * a - 1);
+			mpz_mul_ui(p, p, 6 * a - 1);
+			mpz_neg(p, p);
+
+			// Q = a^3 C^3 / 24
+			mpz_set_ui(q, a);
+			mpz_mul_ui(q, q, a);
+			mpz_mul_ui(q, q, a);
+			mpz_mul_ui(q, q, CHUDNOVSKY_C3_24);
+		}
+
+		// T = P (A + B a)
+		mpz_mul_ui(t, p, CHUDNOVSKY_A + CHUDNOVSKY_B * a);
+		return;
+	}
+
+	const uint64_t m = a + (b - a) / 2;
+
+	mpz_t p2, q2, t2;
+	mpz_inits(p2, q2, t2, NULL);
+
+	split(a, m, p, q, t);
+	split(m, b, p2, q2, t2);
+
+	// T = T(a, m) Q(m, b) + P(a, m) T(m, b)
+	mpz_mul(t, t, q2);
+	mpz_mul(t2, t2, p);
+	mpz_add(t, t, t2);
+
+	mpz_mul(p, p, p2);
+	mpz_mul(q, q, q2);
+
+	mpz_clears(p2, q2, t2, NULL);
+}
+
+/**
+ * @brief Computes the first hex digits of $\pi$, packed two per byte.
+ * @param count the number of 16-digit blocks to compute
+ * @return the count * 8 bytes of digits, allocated by GMP
+ */
+static uint8_t *prefix(const uint64_t count) {
+	const uint64_t digits = BLOCK_SIZE * count;
+	const uint64_t bits = 4 * digits + GUARD_BITS;
+
+	mpz_t p, q, t, root;
+	mpz_inits(p, q, t, root, NULL);
+
+	split(0, bits / BITS_PER_TERM + 2, p, q, t);
+
+	// root = sqrt(10005) * 2^bits
+	mpz_set_ui(root, 10005);
+	mpz_mul_2exp(root, root, 2 * bits);
+	mpz_sqrt(root, root);
+
+	// pi * 2^bits = 426880 * root * Q / T
+	mpz_mul(q, q, root);
+	mpz_mul_ui(q, q, 426880);
+	mpz_tdiv_q(q, q, t);
+
+	// We only keep the decimal part, without the guard bits.
+	mpz_tdiv_q_2exp(q, q, GUARD_BITS);
+	mpz_tdiv_r_2exp(q, q, 4 * digits);
+
+	// The decimal part starts with 0x24, so it has no leading zero byte and
+	// its big-endian bytes are the packed digits.
+	size_t size;
+	uint8_t *bytes = (uint8_t *)mpz_export(NULL, &size, 1, 1, 1, 0, q);
+
+	mpz_clears(p, q, t, root, NULL);
+	return bytes;
+}
+
+/**
+ * @brief Frees the digits computed by prefix().
+ * @param bytes the packed digits
+ * @param count the number of 16-digit blocks
+ */
+static void prefix_free(uint8_t * const bytes, const uint64_t count) {
+	void (*free_function)(void *, size_t);
+	mp_get_memory_functions(NULL, NULL, &free_function);
+
+	free_function(bytes, BYTE * count);
+}
+
+/**
+ * @brief Reads a 16-digit block from the packed digits.
+ * @param bytes the packed digits
+ * @param position the position of the block
+ * @return the 16-digit block
+ */
+static inline uint64_t prefix_block(const uint8_t * const bytes, const uint64_t position) {
+	uint64_t block = 0;
+	for (uint8_t k = 0; k < BYTE; ++k)
+		block = (block << BYTE) | bytes[BYTE * position + k];
+
+	return block;
+}
+
+void pi_prefix(const uint64_t count, uint64_t * const out) {
+	if (count == 0)
+		return;
+
+	uint8_t *bytes = prefix(count);
+
+	for (uint64_t j = 0; j < count; ++j)
+		out[j] = prefix_block(bytes, j);
+
+	prefix_free(bytes, count);
+}
+
+db_return bulk_fill(database * const db, const uint64_t count) {
+	if (count == 0)
+		return (db_return){ .errno = DB_SUCCESS };
+
+	// Each block is read before being overwritten, so the packed digits are
+	// turned into blocks in place.
+	uint8_t *bytes = prefix(count);
+	uint64_t * const blocks = (uint64_t *)bytes;
+
+	for (uint64_t j = 0; j < count; ++j)
+		blocks[j] = prefix_block(bytes, j);
+
+	// The runs of blocks that are not computed yet are written at once.
+	db_return ret = { .errno = DB_SUCCESS };
+	uint64_t j = 0;
+	while (j < count && ret.errno == DB_SUCCESS) {
+		db_return is_computed = db_read_is_computed(db, j);
+		if (is_computed.errno != DB_SUCCESS) {
+			ret = is_computed;
+			break;
+		}
+
+		if (is_computed.value.boolean) {
+			++j;
+			continue;
+		}
+
+		uint64_t end = j + 1;
+		while (end < count && !db_read_is_computed(db, end).value.boolean)
+			++end;
+
+		ret = db_write_range(db, j, end - j, blocks + j);
+		j = end;
+	}
+
+	prefix_free(bytes, count);
+	return ret;
+}
@@ -0,0 +1,134 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "shared.h"
+#include "checksum.h"
+
+/*
+ * The CRC32C is computed bit-reflected, as the SSE 4.2 instruction does: the
+ * lowest bit of the register is the highest power of x.
+ */
+
+/** The CRC32C polynomial, reflected. */
+#define POLYNOMIAL 0x82F63B78U
+
+/** The number of bits of the checksum. */
+#define BITS 32
+
+/** The bytewise lookup table, for the CPUs without SSE 4.2. */
+static uint32_t table[1 << BYTE];
+
+/** The number of powers, enough for any 64-bit number of bytes. */
+#define POWERS (64 + 3)
+
+/** x^(2^k) modulo the polynomial, for each k. */
+static uint32_t powers[POWERS];
+
+/** The checksum kernel in use. */
+static uint32_t (*kernel)(uint32_t, const uint8_t *, uint64_t);
+
+/**
+ * @brief Computes a checksum a byte at a time.
+ * @param crc the checksum of the previous bytes
+ * @param bytes the bytes
+ * @param length the number of bytes
+ * @return the checksum of the previous bytes followed by bytes
+ */
+static uint32_t crc32c_baseline(uint32_t crc, const uint8_t *bytes, uint64_t length) {
+	for (uint64_t k = 0; k < length; ++k)
+		crc = table[(crc ^ bytes[k]) & 0xFF] ^ (crc >> BYTE);
+
+	return crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief Computes a checksum 8 bytes at a time, for SSE 4.2 CPUs.
+ * @param crc the checksum of the previous bytes
+ * @param bytes the bytes
+ * @param length the number of bytes
+ * @return the checksum of the previous bytes followed by bytes
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *bytes, uint64_t length) {
+	uint64_t k = 0;
+
+	for (; length - k >= sizeof(uint64_t); k += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, bytes + k, sizeof(word));
+		crc = (uint32_t)_mm_crc32_u64(crc, word);
+	}
+
+	for (; k < length; ++k)
+		crc = _mm_crc32_u8(crc, bytes[k]);
+
+	return crc;
+}
+#endif
+
+uint32_t crc32c(const uint32_t crc, const void * const bytes, const uint64_t length) {
+	return kernel(crc, (const uint8_t *)bytes, length);
+}
+
+/**
+ * @brief Multiplies two polynomials modulo the polynomial.
+ * @param a the first polynomial, reflected
+ * @param b the second polynomial, reflected
+ * @return a * b modulo the polynomial, reflected
+ */
+static uint32_t multiply(uint32_t a, uint32_t b) {
+	uint32_t product = 0;
+
+	for (uint32_t m = 1U << (BITS - 1); m != 0; m >>= 1) {
+		if (a & m)
+			product ^= b;
+
+		b = b & 1 ? (b >> 1) ^ POLYNOMIAL : b >> 1;
+	}
+
+	return product;
+}
+
+uint32_t crc32c_shift(uint32_t crc, uint64_t length) {
+	// Appending n zeros multiplies the checksum by x^(8n), which is the
+	// product of the x^(2^k) for the bits k of 8n.
+	for (uint8_t k = 3; length != 0; length >>= 1, ++k)
+		if (length & 1)
+			crc = multiply(powers[k], crc);
+
+	return crc;
+}
+
+/**
+ * @brief Builds the tables and selects the kernel at startup.
+ */
+__attribute__((constructor))
+static void crc32c_init(void) {
+	for (uint32_t byte = 0; byte < (1 << BYTE); ++byte) {
+		uint32_t crc = byte;
+		for (uint8_t bit = 0; bit < BYTE; ++bit)
+			crc = crc & 1 ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+
+		table[byte] = crc;
+	}
+
+	// x^1 is the second highest bit, and each power is the square of the
+	// previous one.
+	powers[0] = 1U << (BITS - 2);
+	for (uint8_t k = 1; k < POWERS; ++k)
+		powers[k] = multiply(powers[k - 1], powers[k - 1]);
+
+	kernel = crc32c_baseline;
+
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("sse4.2"))
+		kernel = crc32c_sse42;
+#endif
+}
@@ -1,10 +1,17 @@
+#define _GNU_SOURCE
+
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <gmp.h>
-#include <mpfr.h>
 
+#include "shared.h"
 #include "converter.h"
+#include "database.h"
 
 /** To map hexadecimals to their equivalent character. */
 const char map[] = "0123456789ABCDEF";
@@ -13,72 +20,204 @@ char convert_digit(const uint8_t digit) {
 	return map[digit];
 }
 
-/**
- * The wanted precision as numbers after the comma. Higher is better but
- * slower. Please note that there is no meaning in computing more digits
- * than the precision here, as they will all amount to 0.
- */
-#define PRECISION 33554432
-
-/** The input base. */
-#define INPUT_BASE 16.0
+/** The number of bits of a base 16 digit. */
+#define INPUT_BITS 4
 
 /** The output base. */
 #define OUTPUT_BASE 10
 
 uint8_t *convert(const uint64_t n, const uint8_t * const digits) {
-	mpfr_set_default_prec(PRECISION);
+	uint8_t *output = (uint8_t *)calloc(n, sizeof(uint8_t));
+	if (output == NULL || n == 0)
+		return output;
+
+	// The digits are packed two per byte, the first one in the upper half,
+	// so that they make the integer X = digits * 16^n.
+	const uint64_t bytes = CEIL_DIV(n, 2);
+	uint8_t *packed = (uint8_t *)calloc(bytes, sizeof(uint8_t));
+	if (packed == NULL) {
+		free(output);
+		return NULL;
+	}
+
+	for (uint64_t k = 0; k < n; ++k)
+		packed[k / 2] |= digits[k] << (k % 2 == 0 ? INPUT_BITS : 0);
+
+	mpz_t x, scale;
+	mpz_init(x);
+	mpz_init(scale);
+	mpz_import(x, bytes, 1, sizeof(uint8_t), 1, 0, packed);
+	free(packed);
 
-	/** The final pi number. */
-	mpfr_t pi;
+	// An odd number of digits left an empty half byte at the end.
+	if (n % 2 != 0)
+		mpz_fdiv_q_2exp(x, x, INPUT_BITS);
 
-	/** The $\frac{1}{16^k}$ fraction to convert from base 16 to base 10. */
-	mpfr_t ratio;
+	// The n first decimals are Y = floor(X * 10^n / 2^(4n)), whose radix
+	// conversion is subquadratic inside GMP. The precision only depends on
+	// n, and the conversion is written to memory.
+	mpz_ui_pow_ui(scale, OUTPUT_BASE, n);
+	mpz_mul(x, x, scale);
+	mpz_fdiv_q_2exp(x, x, INPUT_BITS * n);
 
-	/** A single digit. */
-	mpfr_t digit;
+	char *decimal = mpz_get_str(NULL, OUTPUT_BASE, x);
+	const uint64_t length = strlen(decimal);
 
-	uint64_t k = 0;
+	// The leading zeros of Y are not written.
+	for (uint64_t k = 0; k < length; ++k)
+		output[n - length + k] = decimal[k] - '0';
 
-	// Sets initial value.
-	mpfr_init_set_ui(pi, 3ULL, MPFR_RNDD);
-	mpfr_init_set_ui(ratio, 1ULL, MPFR_RNDD);
-	mpfr_init(digit);
+	void (*release)(void *, size_t);
+	mp_get_memory_functions(NULL, NULL, &release);
+	release(decimal, length + 1);
 
-	for (; k < n; ++k) {
-		// ratio /= 16
-		mpfr_div_ui(ratio, ratio, INPUT_BASE, MPFR_RNDD);
+	mpz_clear(x);
+	mpz_clear(scale);
 
-		// Get the k-th digit.
-		mpfr_set_ui(digit, digits[k], MPFR_RNDD);
+	return output;
+}
 
-		// digit *= ratio
-		mpfr_mul(digit, digit, ratio, MPFR_RNDD);
+/** The number of bytes of the budget per limb of a chunk. */
+#define BUDGET_PER_LIMB 128
 
-		// pi += digit
-		mpfr_add(pi, pi, digit, MPFR_RNDD);
+/** The number of decimals that always fit inside a 64-bit limb. */
+#define LIMB_DIGITS 19
+
+/** The suffix of the file holding the fraction between two passes. */
+#define SPILL_SUFFIX ".spill"
+
+/**
+ * @brief Multiplies the fraction by a power of 10, chunk by chunk.
+ * @param db the database, read at the first pass instead of the spill file
+ * @param blocks the number of blocks of the fraction
+ * @param chunk the number of blocks of a chunk
+ * @param first whether this is the first pass
+ * @param fd the spill file
+ * @param scale the power of 10
+ * @param buffer a buffer of a chunk
+ * @param integer the integer part of the product, once the fraction is
+ * replaced by the fractional part
+ * @return only if the fraction could be read and written
+ *
+ * The chunks go from the least significant one, each one carrying its
+ * upper part into the next one.
+ */
+static db_return convert_pass(
+		database * const db,
+		const uint64_t blocks,
+		const uint64_t chunk,
+		const bool first,
+		const int fd,
+		const mpz_t scale,
+		uint64_t * const buffer,
+		mpz_t integer) {
+	mpz_t part;
+	mpz_init(part);
+	mpz_set_ui(integer, 0);
+
+	db_return ret = { .errno = DB_SUCCESS };
+
+	for (uint64_t done = 0; ret.errno == DB_SUCCESS && done < blocks; done += chunk) {
+		const uint64_t limbs = blocks - done < chunk ? blocks - done : chunk;
+		const off_t offset = sizeof(uint64_t) * done;
+
+		// The database holds the most significant block first, and the spill
+		// file the least significant one.
+		if (first) {
+			ret = db_read_range(db, blocks - done - limbs, limbs, buffer);
+			if (ret.errno != DB_SUCCESS)
+				break;
+
+			mpz_import(part, limbs, 1, sizeof(uint64_t), 0, 0, buffer);
+		} else {
+			if (pread(fd, buffer, sizeof(uint64_t) * limbs, offset) != (ssize_t)(sizeof(uint64_t) * limbs)) {
+				ret = (db_return){ .errno = DB_WRITE_FAIL };
+				break;
+			}
+
+			mpz_import(part, limbs, -1, sizeof(uint64_t), 0, 0, buffer);
+		}
+
+		mpz_mul(part, part, scale);
+		mpz_add(part, part, integer);
+		mpz_fdiv_q_2exp(integer, part, 64 * limbs);
+		mpz_fdiv_r_2exp(part, part, 64 * limbs);
+
+		memset(buffer, 0, sizeof(uint64_t) * limbs);
+		mpz_export(buffer, NULL, -1, sizeof(uint64_t), 0, 0, part);
+
+		if (pwrite(fd, buffer, sizeof(uint64_t) * limbs, offset) != (ssize_t)(sizeof(uint64_t) * limbs))
+			ret = (db_return){ .errno = DB_WRITE_FAIL };
 	}
 
-	// We need to go through a temporary file to get the output in base 10.
-	FILE *tmp = tmpfile();
-	mpfr_out_str(tmp, OUTPUT_BASE, n, pi, MPFR_RNDD);
-	fseek(tmp, 0, SEEK_SET);
+	mpz_clear(part);
+	return ret;
+}
 
-	// We now load the file content in our output array.
-	uint8_t *output = (uint8_t *)calloc(n, sizeof(uint8_t));
+db_return convert_database(
+		database * const db,
+		const uint64_t blocks,
+		const char * const path,
+		const uint64_t budget) {
+	// A chunk of the fraction and the power of 10 have as many limbs, and
+	// the budget also holds their product and the decimals.
+	const uint64_t chunk = budget / BUDGET_PER_LIMB == 0 ? 1 : budget / BUDGET_PER_LIMB;
+	const uint64_t step = LIMB_DIGITS * chunk;
+	const uint64_t decimals = BLOCK_SIZE * blocks;
+
+	char spill[strlen(path) + sizeof(SPILL_SUFFIX)];
+	strcpy(spill, path);
+	strcat(spill, SPILL_SUFFIX);
+
+	FILE *output = fopen(path, "wb");
+	const int fd = open(spill, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	uint64_t *buffer = (uint64_t *)malloc(sizeof(uint64_t) * chunk);
+	char *text = (char *)malloc(step + 2);
+
+	db_return ret = { .errno = DB_SUCCESS };
+	if (output == NULL || fd == -1 || buffer == NULL || text == NULL)
+		ret = (db_return){ .errno = DB_OPEN_FAIL };
+
+	mpz_t scale, integer;
+	mpz_init(scale);
+	mpz_init(integer);
+
+	// Each pass multiplies the fraction by 10^step, whose integer part
+	// makes the next decimals, and keeps the fractional part for the next
+	// pass. Only the last pass takes fewer decimals.
+	for (uint64_t done = 0; ret.errno == DB_SUCCESS && done < decimals; done += step) {
+		const uint64_t count = decimals - done < step ? decimals - done : step;
+		if (done == 0 || count != step)
+			mpz_ui_pow_ui(scale, OUTPUT_BASE, count);
+
+		ret = convert_pass(db, blocks, chunk, done == 0, fd, scale, buffer, integer);
+		if (ret.errno != DB_SUCCESS)
+			break;
+
+		// The leading zeros of the integer part are not written by GMP, so
+		// they are put back in front of it.
+		mpz_get_str(text, OUTPUT_BASE, integer);
+		const uint64_t length = mpz_sgn(integer) == 0 ? 0 : strlen(text);
+
+		memmove(text + count - length, text, length);
+		memset(text, '0', count - length);
+
+		if (fwrite(text, 1, count, output) != count)
+			ret = (db_return){ .errno = DB_WRITE_FAIL };
+	}
 
-	// We know the first two characters are the integer part (0) and the comma.
-	fgetc(tmp); fgetc(tmp);
-	for (k = 0; k < n; ++k)
-		output[k] = fgetc(tmp) - '0';
+	mpz_clear(scale);
+	mpz_clear(integer);
+	free(buffer);
+	free(text);
 
-	fclose(tmp);
+	if (fd != -1) {
+		close(fd);
+		unlink(spill);
+	}
 
-	// Cleanup.
-	mpfr_clear(pi);
-	mpfr_clear(ratio);
-	mpfr_clear(digit);
-	mpfr_free_cache();
+	if (output != NULL && fclose(output) != 0 && ret.errno == DB_SUCCESS)
+		ret = (db_return){ .errno = DB_WRITE_FAIL };
 
-	return output;
+	return ret;
 }
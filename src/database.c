@@ -1,7 +1,9 @@
 #define _GNU_SOURCE
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,13 +11,28 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <errno.h>
+
+/**
+ * @brief Gets the error of the last system call that failed.
+ * @return the value of errno
+ *
+ * The macro errno would replace the field of db_return, so it is only used
+ * here, before the field is declared.
+ */
+static inline int db_last_error(void) {
+	return errno;
+}
+
+#undef errno
 
 #include "shared.h"
+#include "checksum.h"
 #include "database.h"
-
-/** Branchless programming to ceil N / M. */
-#define CEIL_DIV(N, M) (((N) + (M) - 1) / (M))
+#include "journal.h"
+#include "shard.h"
 
 /*
  * Implementations details.
@@ -30,7 +47,12 @@
  * sections, as well as the maximum number of digits that can be held in this
  * database.
  *
- * This is fixed size.
+ * This is fixed size. Its padding also holds the number of computed and
+ * checked blocks, and a position before which every block is computed, so
+ * that the progress is known without scanning the bitmaps. They are aligned
+ * inside the mapping, and updated atomically by the writers. After a crash,
+ * they may not match the bitmaps that reached the disk, so they are counted
+ * again once the journal is applied.
  *
  * ### Second section - Relocation table ###
  *
@@ -62,6 +84,11 @@
  * relocation table, then the database may interpret the junk data in the file
  * as valid digits. This would a disaster!
  *
+ * The mapped file only reaches the disk when the kernel wants, so each write
+ * is also appended to a journal (see journal.h), and its flags are only set
+ * once the journal is synced. When the database is opened, the journal is
+ * applied again, then emptied once the file itself is synced.
+ *
  * ### Third section - Data ###
  *
  * The last section is the heart of the database. The data inside is the digits
@@ -73,6 +100,15 @@
  *
  * The blocks are stored linearily, block after block.
  *
+ * ### Checksums ###
+ *
+ * The bitmaps leave room before the data, where the CRC32C of each chunk of
+ * 512 blocks is stored. A write updates the checksum of its chunk with the
+ * checksum of the bytes it changed, as the checksums are linear (see
+ * checksum.h), so the writers of the same chunk never wait for each other.
+ * A chunk is verified the first time it is read after the database is
+ * opened, and db_scrub() verifies every chunk.
+ *
  * ### Performance details ###
  *
  * I won't say this implementation is efficient, I am sure there are far better
@@ -86,10 +122,94 @@
  * table of 157 MB, so quite nothing compared to 5 GB. And I would only need
  * to parse 80 kB to find not computed blocks.
  *
+ * Even 80 kB is too much to parse for each block, so each bitmap is
+ * summarized in memory when the database is opened: a bit per 64-bit word of
+ * the bitmap tells whether the word is full, and so on up to a single word.
+ * Finding a not computed block then reads one word per level.
+ *
+ * Many workers asking for a block would all get the same one, so they claim
+ * ranges instead: a sidecar table records the leased ranges with their
+ * expiry, and a claim hands out the first uncomputed blocks that are not
+ * leased. An expired lease, or one whose blocks were all computed, is
+ * dropped from the table.
+ *
  * For 1 billion digits (my goal), the whole database would be less than
  * 500 MB, when a text file with all the digits (like we found on the internet)
  * is double that.
+ *
+ * ### Shards ###
+ *
+ * A database may also be a manifest of several databases, each holding a
+ * contiguous range of blocks (see shard.h), so that they can live on several
+ * disks. The functions below then hand the positions over to the segments.
+ */
+
+/** The maximum number of levels of a bitmap summary. */
+#define SUMMARY_LEVELS 8
+
+/** The number of bits inside a summary word. */
+#define WORD 64
+
+/** A full summary word. */
+#define FULL UINT64_MAX
+
+/**
+ * A hierarchical summary of a bitmap, kept in memory.
+ *
+ * The level 0 is the bitmap itself, read as 64-bit words. Bit i of the word
+ * w of a level is set when the word 64w + i of the level below is full, so
+ * finding an unset bit only needs one word per level. The bits that go past
+ * the level below are set, as if they were full.
  */
+typedef struct {
+	/// The number of levels above the bitmap.
+	uint8_t levels;
+
+	/// The number of words of each level, the bitmap included.
+	uint64_t words[SUMMARY_LEVELS + 1];
+
+	/// The words of each level above the bitmap.
+	uint64_t *level[SUMMARY_LEVELS + 1];
+} summary_t;
+
+/** The number of blocks of a checksummed chunk. */
+#define CHECKSUM_BLOCKS 512
+
+/** The number of bytes of a checksummed chunk. */
+#define CHECKSUM_CHUNK (BYTE * CHECKSUM_BLOCKS)
+
+/** The number of locks the chunks share to update their checksum. */
+#define CHECKSUM_STRIPES 64
+
+/** The number of locks the chunks share to be written. */
+#define WRITE_STRIPES 64
+
+/** The maximum number of leases at once. */
+#define LEASE_SLOTS 4096
+
+/** The suffix of the lease table, after the database path. */
+#define LEASE_SUFFIX ".leases"
+
+/** A range of blocks handed out to a worker. */
+typedef struct {
+	/// The position of the first block.
+	uint64_t first;
+
+	/// The number of blocks.
+	uint64_t count;
+
+	/// The time, in seconds since the epoch, when the lease expires.
+	uint64_t expiry;
+} lease_t;
+
+/** The lease table, shared by the processes through its mapping. */
+typedef struct {
+	/// The number of leases.
+	uint64_t used;
+
+	/// The leases, sorted by their first block.
+	lease_t leases[LEASE_SLOTS];
+} lease_table_t;
 
 struct database_t {
 	/// The database path, in order to reopen / remap.
@@ -113,8 +233,56 @@ struct database_t {
 	/// The maximum number of digits that can be stored inside the database.
 	uint64_t maximum_digits;
 
+	/// The maximum number of 16-digit blocks, that is the bits in use in a
+	/// bitmap.
+	uint64_t maximum_blocks;
+
 	/// The current size of the file.
 	uint64_t length;
+
+	/// The summaries of the computed and checked bitmaps.
+	summary_t summaries[2];
+
+	/// Held shared to use the mapping, and exclusively to move it.
+	pthread_rwlock_t lock;
+
+	/// The journal of the writes not synced to the file yet.
+	journal *journal;
+
+	/// The segments, if the database is a manifest, else NULL.
+	sharded *shards;
+
+	/// The mapped lease table, once a range was claimed, else NULL.
+	lease_table_t *leases;
+
+	/// The lease table file descriptor.
+	int leases_fd;
+
+	/// Serializes the claims of the threads, which share the file locks.
+	pthread_mutex_t leasing;
+
+	/// The offset of the checksums, or 0 if they do not fit in the file.
+	uint64_t offset_checksums;
+
+	/// The chunks verified since the database was opened, one bit each.
+	uint64_t *verified;
+
+	/// Another open file, whose locks exclude the writers of this process.
+	int verify_fd;
+
+	/// Serializes the verifications, which share the locks of verify_fd.
+	pthread_mutex_t verifying;
+
+	/// Serialize the threads writing a chunk, which share the file locks.
+	pthread_mutex_t stripes[CHECKSUM_STRIPES];
+
+	/// Serialize the threads writing the flags of a chunk, from their check
+	/// to their update.
+	pthread_mutex_t writing[WRITE_STRIPES];
+
+	/// The size of the journal above which it is emptied, raised after a
+	/// failure.
+	uint64_t checkpoint_limit;
 };
 
 #pragma pack(push, 1)
@@ -136,7 +304,16 @@ typedef struct {
 	uint64_t offset_data;
 
 	/// Padding (reserved for future use).
-	uint8_t padding[31];
+	uint8_t padding[7];
+
+	/// Number of computed blocks.
+	uint64_t computed;
+
+	/// Number of checked blocks.
+	uint64_t checked;
+
+	/// Every block before this position is computed.
+	uint64_t hint;
 } header_t;
 #pragma pack(pop)
 
@@ -149,315 +326,2304 @@ typedef struct {
 /** The size of the header. */
 #define HEADER_SIZE 64
 
-db_return db_create(const char * const path, const uint64_t max_digits) {
-	assert(max_digits > 0);
+/** The byte of the header padding set while a migration is in progress. */
+#define MIGRATION_MARKER 0
 
-	FILE* db = fopen(path, "wb");
-	if (db == NULL)
-		return (db_return){ .errno = DB_OPEN_FAIL };
+/** The byte of the header padding set once the counters are exact. */
+#define COUNTERS_MARKER 1
 
-	// Generate the header to print to the file.
-	//
-	// To know the size of the relocation table, we have the following:
-	// For n digits that can be stored, we have two bitmaps (2 * n).
-	// A bit stores 16 digits (2n / 16).
-	// A byte is 8 bits (2n / 16 / 8).
-	// And we pad it to a full byte using branchless programming:
-	// to ceil N / M, we do (N + M - 1) / M.
-	uint64_t bitmaps_size = 2 * CEIL_DIV(max_digits, BLOCK_SIZE * BYTE);
+/** The byte of the header padding set once the checksums are exact. */
+#define CHECKSUMS_MARKER 2
 
-	header_t header = {
-		.magic_number = MAGIC_NUMBER,
-		.version = VERSION,
-		.max_digits = max_digits,
+/** The smallest growth of the file. */
+#define GROWTH_MIN (1ULL << 20)
 
-		// The header is 64 bytes long.
-		.offset_rel = HEADER_SIZE,
+/** The largest growth of the file. */
+#define GROWTH_MAX (1ULL << 30)
 
-		// We compute the relocation table size.
-		.offset_data = HEADER_SIZE + 2 * bitmaps_size,
+/** The size of the journal above which the database is synced to empty it. */
+#define JOURNAL_LIMIT (64ULL << 20)
 
-		// Empty padding.
-		.padding = { 0 },
-	};
+/** Whether the pages of the file are read from the disk as it is mapped. */
+#ifndef POPULATE
+#define POPULATE 0
+#endif
 
-	// Print the header.
-	fwrite(&header, sizeof(header), 1, db);
+/**
+ * @brief Gives the kernel hints on a mapped range of the file.
+ * @param map the start of the range
+ * @param length the length of the range
+ *
+ * The data is written sequentially, so transparent huge pages cut the page
+ * faults and the page-table churn. The hints may be ignored, so they cannot
+ * fail.
+ */
+static inline void db_advise(uint8_t * const map, const uint64_t length) {
+	madvise(map, length, MADV_HUGEPAGE);
 
-	// Print an empty bitmap.
-	uint8_t bitmaps[bitmaps_size];
-	memset(bitmaps, 0, sizeof(bitmaps));
-	fwrite(&bitmaps, sizeof(bitmaps), 1, db);
-	fwrite(&bitmaps, sizeof(bitmaps), 1, db);
+	if (POPULATE)
+		madvise(map, length, MADV_WILLNEED);
+}
 
-	// We finished creating the database.
-	// We flush and close.
-	fflush(db);
-	fclose(db);
+/**
+ * @brief Gets a counter of the header.
+ * @param db the database
+ * @param field the offset of the counter inside the header
+ * @return the counter, inside the mapping
+ */
+static inline uint64_t *db_counter(const database * const db, const size_t field) {
+	return (uint64_t *)(db->map + field);
+}
 
-	return (db_return){ .errno = DB_SUCCESS };
+/**
+ * @brief Raises the position before which every block is computed.
+ * @param db the database
+ * @param position a position before which every block is computed
+ */
+static void hint_update(const database * const db, const uint64_t position) {
+	uint64_t * const hint = db_counter(db, offsetof(header_t, hint));
+	uint64_t current = __atomic_load_n(hint, __ATOMIC_RELAXED);
+
+	while (current < position
+			&& !__atomic_compare_exchange_n(hint, &current, position, true,
+				__ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
 }
 
-db_return db_open(const char * const path) {
-	// Check if file exists and we have permissions.
-	struct stat st;
+/**
+ * @brief Reads a 64-bit word of a bitmap.
+ * @param db the database to query
+ * @param offset the offset of the bitmap inside the relocation table
+ * @param w the index of the word
+ * @return the word, with the first block in the upper bit
+ *
+ * The bytes past the end of the bitmap are read as full.
+ */
+static inline uint64_t bitmap_word(
+		const database * const db,
+		const uint64_t offset,
+		const uint64_t w) {
+	const uint8_t * const bytes = db->map + db->offset_rel + offset + BYTE * w;
+	const uint64_t available = db->offset_bitmap - BYTE * w;
+
+	uint64_t word = FULL;
+	memcpy(&word, bytes, available < BYTE ? available : BYTE);
+
+	// The first block is in the upper bit of the first byte.
+	return __builtin_bswap64(word);
+}
 
-	if (
-			stat(path, &st) != 0
-			|| !S_ISREG(st.st_mode)
-			|| access(path, F_OK)
-			|| access(path, R_OK) != 0
-			|| access(path, W_OK) != 0
-		) return (db_return){ .errno = DB_OPEN_FAIL };
+/**
+ * @brief Gets the summary of a bitmap.
+ * @param db the database
+ * @param offset the offset of the bitmap inside the relocation table
+ * @return the summary of the bitmap
+ */
+static inline summary_t *summary_of(database * const db, const uint64_t offset) {
+	return &db->summaries[offset == 0 ? 0 : 1];
+}
 
-	// Open the file.
-	FILE *file = fopen(path, "rb+");
-	if (file == NULL)
-		return (db_return){ .errno = DB_OPEN_FAIL };
+/**
+ * @brief Frees the levels of a summary.
+ * @param summary the summary to free
+ */
+static void summary_free(summary_t * const summary) {
+	for (uint8_t l = 1; l <= summary->levels; ++l)
+		free(summary->level[l]);
 
-	// Read the header.
-	header_t header;
-	if (fread(&header, sizeof(header), 1, file) != 1) {
-		fclose(file);
-		return (db_return){ .errno = DB_OPEN_FAIL };
-	}
+	summary->levels = 0;
+}
 
-	// Verify the magic number and the version.
-	if (memcmp(header.magic_number, MAGIC_NUMBER, 8) != 0
-			|| header.version != VERSION) {
-		fclose(file);
-		return (db_return){ .errno = DB_OPEN_WRONG_FORMAT };
-	}
+/**
+ * @brief Builds the summary of a bitmap.
+ * @param db the database
+ * @param offset the offset of the bitmap inside the relocation table
+ * @return whether the summary could be allocated
+ */
+static bool summary_build(database * const db, const uint64_t offset) {
+	summary_t * const summary = summary_of(db, offset);
+
+	summary->levels = 0;
+	summary->words[0] = CEIL_DIV(db->offset_bitmap, BYTE);
+
+	// The words before the hint are full, so they are not read.
+	const uint64_t hint = *db_counter(db, offsetof(header_t, hint));
+	const uint64_t skip = offset != 0 ? 0
+		: (hint < db->maximum_blocks ? hint : db->maximum_blocks) / WORD;
+
+	// We add levels until one word summarizes everything.
+	for (uint8_t l = 1; l <= SUMMARY_LEVELS; ++l) {
+		const uint64_t below = summary->words[l - 1];
+		summary->words[l] = CEIL_DIV(below, WORD);
+		summary->level[l] = (uint64_t *)malloc(summary->words[l] * sizeof(uint64_t));
+
+		if (summary->level[l] == NULL) {
+			summary_free(summary);
+			return false;
+		}
 
-	// Once we have the file, we can construct the database.
-	database *db = (database *)malloc(sizeof(database));
+		summary->levels = l;
 
-	db->path = path;
-	db->offset_rel = header.offset_rel;
-	db->offset_data = header.offset_data;
-	db->maximum_digits = header.max_digits;
-	db->offset_bitmap = CEIL_DIV(header.max_digits, BLOCK_SIZE * BYTE);
-	db->length = st.st_size;
+		for (uint64_t w = 0; w < summary->words[l]; ++w) {
+			uint64_t word = 0;
 
-	// We now need to mmap the file to access it.
-	int fd = fileno(file);
-	db->fd = fd;
-	db->map =
-		(uint8_t *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if (db->map == MAP_FAILED) {
-		fclose(file);
-		return (db_return){ .errno = DB_OPEN_FAIL };
+			for (uint8_t bit = 0; bit < WORD; ++bit) {
+				const uint64_t child = WORD * w + bit;
+				const bool full = child >= below || (l == 1
+					? child < skip || bitmap_word(db, offset, child) == FULL
+					: summary->level[l - 1][child] == FULL);
+
+				word |= (uint64_t)full << bit;
+			}
+
+			summary->level[l][w] = word;
+		}
+
+		if (summary->words[l] == 1)
+			break;
 	}
 
-	return (db_return){
-		.errno = DB_SUCCESS,
-		.value = { .database = db },
-	};
+	return true;
 }
 
-void db_close(database * const db) {
-	munmap(db->map, db->length);
-	close(db->fd);
-	free(db);
+/**
+ * @brief Marks a word as full in a summary.
+ * @param summary the summary to update
+ * @param level the level above the full word
+ * @param w the index of the full word
+ */
+static void summary_fill(summary_t * const summary, uint8_t level, uint64_t w) {
+	// A full word may in turn fill its parent word.
+	for (; level <= summary->levels; ++level) {
+		const uint64_t word = __atomic_or_fetch(
+			&summary->level[level][w / WORD], 1ULL << (w % WORD), __ATOMIC_SEQ_CST);
+
+		w /= WORD;
+		if (word != FULL)
+			return;
+	}
 }
 
 /**
- * @brief Reads a position for a block.
- * @param db the database to query
- * @param offset if there is an offset in the relocation table to handle
- * @return the position of a bit not set in the relocation header
- *
- * For the errors, it returns the error DB_READ_OUT_OF_BOUNDS which
- * must be changed to DB_READ_NO_UNCOMPUTED/UNCHECKED by the caller.
+ * @brief Marks a bitmap word as full in the summary, if it is.
+ * @param db the database
+ * @param offset the offset of the bitmap inside the relocation table
+ * @param position the position of the bit that has been set
  */
-static db_return db_read_position(database * const db, const uint64_t offset) {
-	// We need to read the bytes from the offset_rel but no more than
-	// offset_bitmap. If a byte is no 0xFF, it means there is at least a
-	// 0 and we get it.
-	for (uint64_t k = 0; k < db->offset_bitmap; ++k) {
-		if (db->map[db->offset_rel + offset + k] == 0xFF)
-			continue;
-
-		// We parsed k bytes, meaning k * 8 16-digit blocks.
-		// Now we need to know which one inside the current 8 bits is null.
-		const uint8_t byte = db->map[db->offset_rel + offset + k];
-		for (uint8_t shift = BYTE; shift > 0; --shift) {
-			const uint8_t bit = byte >> (shift - 1);
-			if ((bit & 1) == 0) {
-				// We got the position (8 - shift) of the bit inside the byte.
-				return (db_return){
-					.errno = DB_SUCCESS,
-					.value = { .position = BYTE * k + (BYTE - shift) },
-				};
-			}
-		}
+static void summary_update(database * const db, const uint64_t offset, const uint64_t position) {
+	summary_t * const summary = summary_of(db, offset);
+	const uint64_t w = position / WORD;
 
-		// We aren't supposed to get out, because if the byte is not
-		// all 1, there is at least a 0.
-	}
+	if (w >= summary->words[0] || bitmap_word(db, offset, w) != FULL)
+		return;
 
-	// We came out, meaning we computed or checked every block.
-	return (db_return){ .errno = DB_READ_OUT_OF_BOUNDS };
+	summary_fill(summary, 1, w);
 }
 
+/**
+ * @brief Finds the first word of a bitmap that is not full, from a word on.
+ * @param summary the summary of the bitmap
+ * @param w the index of the first word to consider
+ * @param level the level above the word found
+ * @return the index of the word, or the number of words if they are all full
+ *
+ * The word may be full if the summary lags behind, in which case the caller
+ * marks it as full and searches again.
+ */
+static uint64_t summary_next(summary_t * const summary, uint64_t w, uint8_t * const level) {
+	uint8_t l = 1;
 
-db_return db_read_uncomputed(database * const db) {
-	db_return ret = db_read_position(db, 0);
+	// We go up while the words left on the level are full...
+	for (;; ++l) {
+		if (l > summary->levels || w >= summary->words[l - 1])
+			return summary->words[0];
 
-	if (ret.errno == DB_SUCCESS)
-		return ret;
+		const uint64_t word = __atomic_load_n(&summary->level[l][w / WORD], __ATOMIC_SEQ_CST)
+			| ((1ULL << (w % WORD)) - 1);
 
-	return (db_return){ .errno = DB_READ_NO_UNCOMPUTED };
-}
+		if (word != FULL) {
+			w = WORD * (w / WORD) + __builtin_ctzll(~word);
+			break;
+		}
 
-db_return db_read_unchecked(database * const db) {
-	db_return ret = db_read_position(db, db->offset_bitmap);
+		w = w / WORD + 1;
+	}
 
-	if (ret.errno == DB_SUCCESS)
-		return ret;
+	// ... then down the first word that is not full on each level.
+	for (; l > 1; --l) {
+		const uint64_t word = __atomic_load_n(&summary->level[l - 1][w], __ATOMIC_SEQ_CST);
+		if (word == FULL)
+			break;
 
-	return (db_return){ .errno = DB_READ_NO_UNCHECKED };
+		w = WORD * w + __builtin_ctzll(~word);
+	}
+
+	*level = l;
+	return w;
 }
 
 /**
- * @brief Reads a computed/checked flag.
- * @param db the database to query
- * @param position the position of the block to query
- * @param offset an optional offset inside the relocation table
- * @return whether the block at position has its flag set
+ * @brief Finds the first unset bit of a bitmap through its summary.
+ * @param db the database
+ * @param offset the offset of the bitmap inside the relocation table
+ * @param start the position from which to search
+ * @param position the position of the first unset bit from start
+ * @return whether there is an unset bit
+ *
+ * The summary may lag behind the bitmap, when another thread is updating it
+ * or when another process set the flags. A full word found on the way is
+ * then marked in the summary, and the search starts again.
  */
-static db_return db_read_flag(database * const db, const uint64_t position, const uint64_t offset) {
-	if (position >= db->maximum_digits)
-		return (db_return){ .errno = DB_READ_OUT_OF_BOUNDS };
+static bool summary_find(
+		database * const db,
+		const uint64_t offset,
+		const uint64_t start,
+		uint64_t * const position) {
+	summary_t * const summary = summary_of(db, offset);
+	const uint64_t first = start / WORD;
+
+	if (first >= summary->words[0])
+		return false;
+
+	// The bits before start are ignored inside the first word.
+	const uint64_t before = start % WORD == 0 ? 0 : ~(FULL >> (start % WORD));
+	const uint64_t word = bitmap_word(db, offset, first) | before;
+
+	if (word != FULL) {
+		*position = WORD * first + __builtin_clzll(~word);
+		return true;
+	}
 
-	// We first fetch the byte where the block flag is set.
-	const uint8_t byte = db->map[db->offset_rel + offset + position / BYTE];
+	for (;;) {
+		uint8_t l;
+		const uint64_t w = summary_next(summary, first + 1, &l);
 
-	// We then query the flag.
-	const uint8_t shift = BYTE - (position % BYTE) - 1;
-	const bool is_set = (byte >> shift) & 1;
+		if (w >= summary->words[0])
+			return false;
 
-	return (db_return){
-		.errno = DB_SUCCESS,
-		.value = { .boolean = is_set },
-	};
-}
+		if (l > 1) {
+			summary_fill(summary, l, w);
+			continue;
+		}
 
+		const uint64_t found = bitmap_word(db, offset, w);
+		if (found != FULL) {
+			*position = WORD * w + __builtin_clzll(~found);
+			return true;
+		}
 
-inline db_return db_read_is_computed(database * const db, const uint64_t position) {
-	return db_read_flag(db, position, 0);
+		summary_fill(summary, 1, w);
+	}
 }
 
-inline db_return db_read_is_checked(database * const db, const uint64_t position) {
-	return db_read_flag(db, position, db->offset_bitmap);
+/**
+ * @brief Reads a flag from a bitmap.
+ * @param bitmap the bitmap
+ * @param position the position of the block
+ * @return whether the flag is set
+ */
+static inline bool bitmap_bit(const uint8_t * const bitmap, const uint64_t position) {
+	const uint8_t byte = __atomic_load_n(&bitmap[position / BYTE], __ATOMIC_ACQUIRE);
+	return (byte >> (BYTE - (position % BYTE) - 1)) & 1;
 }
 
-db_return db_read(database * const db, const uint64_t position) {
-	db_return is_computed = db_read_is_computed(db, position);
-	if (is_computed.errno != DB_SUCCESS)
-		return is_computed;
+/**
+ * @brief Tests whether a range of a bitmap holds a given flag.
+ * @param db the database to query
+ * @param offset the offset of the bitmap inside the relocation table
+ * @param first the first block of the range
+ * @param count the number of blocks of the range
+ * @param set the flag to look for
+ * @return whether a block of the range has its flag equal to set
+ */
+static bool bitmap_any(
+		const database * const db,
+		const uint64_t offset,
+		const uint64_t first,
+		const uint64_t count,
+		const bool set) {
+	const uint8_t * const bitmap = db->map + db->offset_rel + offset;
+	const uint64_t flip = set ? 0 : FULL;
+	const uint64_t end = first + count;
+	uint64_t k = first;
+
+	// The unaligned bits are tested one by one, and the others a word or a
+	// byte at a time.
+	for (; k < end && k % BYTE != 0; ++k)
+		if (bitmap_bit(bitmap, k) == set)
+			return true;
+
+	for (; end - k >= WORD; k += WORD) {
+		uint64_t word;
+		memcpy(&word, bitmap + k / BYTE, sizeof(word));
+		if ((word ^ flip) != 0)
+			return true;
+	}
 
-	if (is_computed.value.boolean != true)
-		return (db_return){ .errno = DB_READ_NOT_READY };
+	for (; end - k >= BYTE; k += BYTE)
+		if ((uint8_t)(bitmap[k / BYTE] ^ flip) != 0)
+			return true;
 
-	// We store the block inside a uint64_t.
-	uint64_t block = 0;
-	for (uint8_t k = 0; k < BYTE; ++k) {
-		// A 16-byte block fits inside 8 bytes.
-		// So our position must be multiplied by 8.
-		const uint8_t byte = db->map[db->offset_data + BYTE * position + k];
-		block = (block << BYTE) | byte;
-	}
+	for (; k < end; ++k)
+		if (bitmap_bit(bitmap, k) == set)
+			return true;
 
-	return (db_return){
-		.errno = DB_SUCCESS,
-		.value = { .block = block },
-	};
+	return false;
 }
 
 /**
- * @brief Writes a computed/checked flag.
- * @param db the database to query
- * @param position the position of the block to write
- * @param offset an optional offset inside the relocation table
+ * @brief Sets the flags of a range of a bitmap.
+ * @param db the database to update
+ * @param offset the offset of the bitmap inside the relocation table
+ * @param first the first block of the range
+ * @param count the number of blocks of the range
+ * @return whether no flag of the range was set before
+ *
+ * The flags are set with atomic fetch-or, after the stores that precede
+ * them, so concurrent writers of neighbouring blocks do not lose any flag.
  */
-static db_return db_write_flag(database * const db, const uint64_t position, const uint64_t offset) {
-	if (position >= db->maximum_digits)
-		return (db_return){ .errno = DB_WRITE_OUT_OF_BOUNDS };
+static bool bitmap_set(
+		database * const db,
+		const uint64_t offset,
+		const uint64_t first,
+		const uint64_t count) {
+	uint8_t * const bitmap = db->map + db->offset_rel + offset;
+	const uint64_t end = first + count;
+	uint8_t previous = 0;
+	uint64_t added = 0;
+
+	for (uint64_t k = first; k < end;) {
+		// The bits of the range inside the byte of k.
+		const uint8_t from = k % BYTE;
+		const uint8_t to = end - k < (uint64_t)(BYTE - from) ? from + (end - k) : BYTE;
+		const uint8_t mask = (0xFF >> from) & (0xFF << (BYTE - to));
+
+		const uint8_t before = __atomic_fetch_or(&bitmap[k / BYTE], mask, __ATOMIC_SEQ_CST) & mask;
+		previous |= before;
+		added += __builtin_popcount(mask & ~before);
+		k += to - from;
+	}
 
-	// The shift to set the bit.
-	const uint8_t shift = BYTE - (position % BYTE) - 1;
+	// Only the bits we set are counted, so a write applied again is not.
+	if (added > 0)
+		__atomic_add_fetch(db_counter(db, offset == 0
+			? offsetof(header_t, computed)
+			: offsetof(header_t, checked)), added, __ATOMIC_SEQ_CST);
 
-	// We set the flag inside the byte.
-	db->map[db->offset_rel + offset + position / BYTE] |= 1 << shift;
+	// Each bitmap word of the range may have been filled.
+	if (count > 0)
+		for (uint64_t w = first / WORD; w <= (end - 1) / WORD; ++w)
+			summary_update(db, offset, WORD * w);
 
-	return (db_return){ .errno = DB_SUCCESS };
+	return previous == 0;
 }
 
 /**
- * @brief Resizes the data portion of the database to be bigger
- * @param db the database to grow
- * @param size the new size of the file
- * @return whether the migration succeeded
+ * @brief Locks a byte range of the file against the other processes.
+ * @param db the database to lock
+ * @param type F_RDLCK, F_WRLCK or F_UNLCK
+ * @param start the first byte of the range
+ * @param length the number of bytes of the range
+ * @return whether the lock is held
+ *
+ * The locks belong to the open file, so they do not exclude the threads of
+ * the process, which share the file descriptor.
  */
-static inline db_return db_resize(database * const db, const uint64_t size) {
-	if (size < db->length)
-		return (db_return){ .errno = DB_MIGRATE_FAIL };
+static bool db_lock_file(
+		const database * const db,
+		const short type,
+		const uint64_t start,
+		const uint64_t length) {
+	struct flock lock = {
+		.l_type = type,
+		.l_whence = SEEK_SET,
+		.l_start = start,
+		.l_len = length,
+	};
 
-	if (ftruncate(db->fd, size) == -1)
-		return (db_return){ .errno = DB_MIGRATE_FAIL };
+	return fcntl(db->fd, F_OFD_SETLKW, &lock) != -1;
+}
 
-	uint8_t *map = (uint8_t *)mremap(db->map, db->length, size, MREMAP_MAYMOVE);
-	if (map == MAP_FAILED)
-		return (db_return){ .errno = DB_MIGRATE_FAIL };
+/**
+ * @brief Copies blocks between the database and the memory.
+ * @param to where to copy the blocks
+ * @param from the blocks to copy
+ * @param count the number of blocks
+ *
+ * The blocks are stored big-endian inside the database, so that the digits
+ * are in order, thus copying swaps the bytes in either direction.
+ */
+static inline void db_copy_blocks(void * const to, const void * const from, const uint64_t count) {
+	for (uint64_t k = 0; k < count; ++k) {
+		uint64_t block;
+		memcpy(&block, (const uint8_t *)from + BYTE * k, sizeof(block));
+		block = __builtin_bswap64(block);
+		memcpy((uint8_t *)to + BYTE * k, &block, sizeof(block));
+	}
+}
 
-	db->map = map;
-	db->length = size;
+static db_return db_reserve(database * const db, const uint64_t size);
+static db_return db_migrate_resume(database * const db);
 
-	return (db_return){ .errno = DB_SUCCESS };
-}
+/**
+ * @brief Places the checksums inside the file.
+ * @param db the database, with its current layout
+ * @return whether the verified chunks could be allocated
+ */
+static bool checksum_setup(database * const db) {
+	const uint64_t chunks = CEIL_DIV(db->maximum_blocks, CHECKSUM_BLOCKS);
 
-db_return db_write_computed(database * const db, const uint64_t position, const uint64_t digits) {
-	db_return is_computed = db_read_is_computed(db, position);
-	if (is_computed.errno != DB_SUCCESS)
-		return is_computed;
+	// The checksums are aligned, so that they are updated atomically. The
+	// smallest databases do not have room for them.
+	const uint64_t start = BYTE * CEIL_DIV(db->offset_rel + 2 * db->offset_bitmap, BYTE);
+	db->offset_checksums = start + sizeof(uint32_t) * chunks <= db->offset_data ? start : 0;
 
-	if (is_computed.value.boolean != false)
-		return (db_return){ .errno = DB_WRITE_ALREADY_COMPUTED };
+	free(db->verified);
+	db->verified = (uint64_t *)calloc(CEIL_DIV(chunks, WORD), sizeof(uint64_t));
 
-	// If the file is too short, we need to extend it.
-	// Because this manipulates the intrinsics of the database object,
-	// we will need to implement a mutex lock.
-	const uint8_t block_length = BLOCK_SIZE / 2;
-	const uint64_t size = db->offset_data + position / 2 + block_length;
-	if (size >= db->length) {
-		db_return resize = db_resize(db, size);
-		if (resize.errno != DB_SUCCESS)
-			return resize;
+	return db->verified != NULL;
+}
+
+/**
+ * @brief Tells whether the checksums can be verified.
+ * @param db the database
+ * @return whether the checksums match the data
+ */
+static inline bool checksum_enabled(const database * const db) {
+	return db->offset_checksums != 0
+		&& db->map[offsetof(header_t, padding) + CHECKSUMS_MARKER] != 0;
+}
+
+/**
+ * @brief Gets the checksum of a chunk.
+ * @param db the database
+ * @param chunk the index of the chunk
+ * @return the checksum, inside the mapping
+ */
+static inline uint32_t *checksum_of(const database * const db, const uint64_t chunk) {
+	return (uint32_t *)(db->map + db->offset_checksums + sizeof(uint32_t) * chunk);
+}
+
+/**
+ * @brief Computes the checksum of a chunk from its data.
+ * @param db the database
+ * @param chunk the index of the chunk
+ * @return the checksum of the chunk
+ *
+ * The bytes past the end of the file are zeros, as they will be once the
+ * file grows.
+ */
+static uint32_t checksum_compute(const database * const db, const uint64_t chunk) {
+	const uint64_t start = db->offset_data + CHECKSUM_CHUNK * chunk;
+	if (start >= db->length)
+		return 0;
+
+	const uint64_t length = db->length - start < CHECKSUM_CHUNK ? db->length - start : CHECKSUM_CHUNK;
+	return crc32c_shift(crc32c(0, db->map + start, length), CHECKSUM_CHUNK - length);
+}
+
+/**
+ * @brief Computes again the checksums of the chunks of a range.
+ * @param db the database, without any writer
+ * @param first the first block of the range
+ * @param count the number of blocks of the range
+ */
+static void checksum_rebuild(database * const db, const uint64_t first, const uint64_t count) {
+	if (db->offset_checksums == 0 || count == 0)
+		return;
+
+	for (uint64_t c = first / CHECKSUM_BLOCKS; c <= (first + count - 1) / CHECKSUM_BLOCKS; ++c)
+		*checksum_of(db, c) = checksum_compute(db, c);
+}
+
+/**
+ * @brief Copies blocks into the database, and updates their checksums.
+ * @param db the database
+ * @param first the first block of the range
+ * @param count the number of blocks of the range
+ * @param digits the count 16-digit blocks
+ */
+static void checksum_copy(
+		database * const db,
+		const uint64_t first,
+		const uint64_t count,
+		const uint64_t * const digits) {
+	uint8_t * const data = db->map + db->offset_data;
+
+	if (db->offset_checksums == 0) {
+		db_copy_blocks(data + BYTE * first, digits, count);
+		return;
+	}
+
+	for (uint64_t k = first; k < first + count;) {
+		const uint64_t chunk = k / CHECKSUM_BLOCKS;
+		const uint64_t end = CHECKSUM_BLOCKS * (chunk + 1);
+		const uint64_t length = first + count - k < end - k ? first + count - k : end - k;
+		uint8_t * const bytes = data + BYTE * k;
+
+		// A thread writing the same blocks must see them before or after
+		// the copy, so that the change is counted once.
+		pthread_mutex_t * const stripe = &db->stripes[chunk % CHECKSUM_STRIPES];
+		pthread_mutex_lock(stripe);
+
+		const uint32_t before = crc32c(0, bytes, BYTE * length);
+		db_copy_blocks(bytes, digits + (k - first), length);
+		const uint32_t after = crc32c(0, bytes, BYTE * length);
+
+		// The change of the chunk is the change of these bytes, followed by
+		// the rest of the chunk, unchanged.
+		const uint32_t change = crc32c_shift(before ^ after, BYTE * (end - k - length));
+		__atomic_xor_fetch(checksum_of(db, chunk), change, __ATOMIC_SEQ_CST);
+
+		pthread_mutex_unlock(stripe);
+		k += length;
+	}
+}
+
+/**
+ * @brief Verifies the checksum of a chunk.
+ * @param db the database, locked shared
+ * @param chunk the index of the chunk
+ * @return whether the chunk matches its checksum
+ *
+ * The chunk is locked through another open file, so that no writer, in this
+ * process or another one, is between its copy and its checksum. Another
+ * process may have written the chunk past our mapping, which then grows.
+ */
+static bool checksum_verify(database * const db, const uint64_t chunk) {
+	const uint64_t start = db->offset_data + CHECKSUM_CHUNK * chunk;
+	struct flock lock = {
+		.l_whence = SEEK_SET,
+		.l_start = start,
+		.l_len = CHECKSUM_CHUNK,
+	};
+
+	for (;;) {
+		pthread_mutex_lock(&db->verifying);
+
+		lock.l_type = F_RDLCK;
+		if (fcntl(db->verify_fd, F_OFD_SETLKW, &lock) == -1) {
+			pthread_mutex_unlock(&db->verifying);
+			return false;
+		}
+
+		struct stat st;
+		const bool mapped = fstat(db->fd, &st) == 0
+			&& (start + CHECKSUM_CHUNK <= db->length || (uint64_t)st.st_size <= db->length);
+
+		const bool valid = mapped && checksum_compute(db, chunk)
+			== __atomic_load_n(checksum_of(db, chunk), __ATOMIC_SEQ_CST);
+
+		lock.l_type = F_UNLCK;
+		fcntl(db->verify_fd, F_OFD_SETLK, &lock);
+		pthread_mutex_unlock(&db->verifying);
+
+		if (valid)
+			__atomic_or_fetch(&db->verified[chunk / WORD], 1ULL << (chunk % WORD), __ATOMIC_SEQ_CST);
+
+		if (mapped)
+			return valid;
+
+		const uint64_t end = start + CHECKSUM_CHUNK;
+		if (db_reserve(db, (uint64_t)st.st_size < end ? (uint64_t)st.st_size : end).errno != DB_SUCCESS)
+			return false;
+	}
+}
+
+/**
+ * @brief Verifies the chunks of a range, unless they were already.
+ * @param db the database, locked shared
+ * @param first the first block of the range
+ * @param count the number of blocks of the range
+ * @return whether every chunk matches its checksum
+ */
+static bool checksum_check(database * const db, const uint64_t first, const uint64_t count) {
+	if (!checksum_enabled(db) || count == 0)
+		return true;
+
+	for (uint64_t c = first / CHECKSUM_BLOCKS; c <= (first + count - 1) / CHECKSUM_BLOCKS; ++c) {
+		const uint64_t word = __atomic_load_n(&db->verified[c / WORD], __ATOMIC_ACQUIRE);
+
+		if (!((word >> (c % WORD)) & 1) && !checksum_verify(db, c))
+			return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * @brief Syncs the mapped file to the disk.
+ * @param context the database
+ * @return whether the file is durable
+ */
+static bool db_sync(void * const context) {
+	const database * const db = (const database *)context;
+	return msync(db->map, db->length, MS_SYNC) == 0;
+}
+
+/**
+ * @brief Applies a journaled write to the database.
+ * @param context the database, locked shared
+ * @param kind the kind of the write
+ * @param first the position of the first block
+ * @param count the number of blocks
+ * @param digits the count 16-digit blocks, if they were computed
+ * @return whether the write could be applied
+ *
+ * The write may have already reached the file, so the flags already set
+ * are not an error.
+ */
+static bool db_apply(
+		void * const context,
+		const journal_kind kind,
+		const uint64_t first,
+		const uint64_t count,
+		const uint64_t * const digits) {
+	database * const db = (database *)context;
+
+	if (count > db->maximum_blocks || first > db->maximum_blocks - count)
+		return false;
+
+	if (kind == JOURNAL_CHECKED) {
+		bitmap_set(db, db->offset_bitmap, first, count);
+		return true;
+	}
+
+	db_return reserve = db_reserve(db, db->offset_data + BYTE * (first + count));
+	if (reserve.errno != DB_SUCCESS)
+		return false;
+
+	db_copy_blocks(db->map + db->offset_data + BYTE * first, digits, count);
+	checksum_rebuild(db, first, count);
+	bitmap_set(db, 0, first, count);
+
+	return true;
+}
+
+/**
+ * @brief Counts the flags set inside a bitmap.
+ * @param db the database
+ * @param offset the offset of the bitmap inside the relocation table
+ * @return the number of flags set
+ */
+static uint64_t bitmap_count(const database * const db, const uint64_t offset) {
+	const uint8_t * const bitmap = db->map + db->offset_rel + offset;
+	uint64_t count = 0, k = 0;
+
+	for (; db->offset_bitmap - k >= BYTE; k += BYTE) {
+		uint64_t word;
+		memcpy(&word, bitmap + k, sizeof(word));
+		count += __builtin_popcountll(word);
+	}
+
+	for (; k < db->offset_bitmap; ++k)
+		count += __builtin_popcount(bitmap[k]);
+
+	return count;
+}
+
+/**
+ * @brief Counts the flags again if needed, then syncs the mapped file.
+ * @param context the database, used by no other process
+ * @return whether the file is durable
+ *
+ * The counters are counted again after a crash, when the journal is not
+ * empty, or if the database was created before them. So are the checksums,
+ * if the database was created before them.
+ */
+static bool db_recount(void * const context) {
+	database * const db = (database *)context;
+	uint8_t * const counted = db->map + offsetof(header_t, padding) + COUNTERS_MARKER;
+
+	if (journal_size(db->journal) != 0 || *counted == 0) {
+		uint64_t position;
+		if (!summary_find(db, 0, 0, &position) || position > db->maximum_blocks)
+			position = db->maximum_blocks;
+
+		*db_counter(db, offsetof(header_t, computed)) = bitmap_count(db, 0);
+		*db_counter(db, offsetof(header_t, checked)) = bitmap_count(db, db->offset_bitmap);
+		*db_counter(db, offsetof(header_t, hint)) = position;
+		*counted = 1;
+	}
+
+	// The checksums are trusted once they are all durable.
+	uint8_t * const summed = db->map + offsetof(header_t, padding) + CHECKSUMS_MARKER;
+	if (*summed == 0 && db->offset_checksums != 0) {
+		checksum_rebuild(db, 0, db->maximum_blocks);
+
+		if (!db_sync(db))
+			return false;
+
+		*summed = 1;
+	}
+
+	return db_sync(db);
+}
+
+/**
+ * @brief Applies the journal again, and empties it.
+ * @param db the database
+ * @return whether every durable write is inside the database
+ */
+static bool db_recover(database * const db) {
+	// The writers of the other processes hold their range from before they
+	// journal a write until its flags are set, so that a write we apply
+	// again is never half done.
+	if (!db_lock_file(db, F_WRLCK, db->offset_rel, 0))
+		return false;
+
+	// The checksums of the chunks are computed from the whole file.
+	struct stat st;
+	pthread_rwlock_rdlock(&db->lock);
+
+	const bool applied = fstat(db->fd, &st) == 0
+		&& db_reserve(db, st.st_size).errno == DB_SUCCESS
+		&& journal_replay(db->journal, db_apply, db);
+
+	pthread_rwlock_unlock(&db->lock);
+
+	db_lock_file(db, F_UNLCK, db->offset_rel, 0);
+
+	// The journal is only emptied by the last process to use it, which is
+	// then the only one to use the counters.
+	if (applied)
+		journal_checkpoint(db->journal, db_recount, db);
+
+	return applied;
+}
+
+/**
+ * @brief Empties the journal once it is too big.
+ * @param db the database, not locked
+ *
+ * The journal is shared by the processes, and the first one to find it too
+ * big empties it for all of them.
+ */
+static void db_checkpoint(database * const db) {
+	if (journal_size(db->journal) < __atomic_load_n(&db->checkpoint_limit, __ATOMIC_RELAXED))
+		return;
+
+	// The writers of this process are out, so every write they journaled is
+	// inside the mapping.
+	pthread_rwlock_wrlock(&db->lock);
+
+	uint64_t size = journal_size(db->journal);
+	if (size < db->checkpoint_limit) {
+		pthread_rwlock_unlock(&db->lock);
+		return;
+	}
+
+	// The writers of the other processes hold their range from before they
+	// journal a write until its flags are set, so they are out as well. The
+	// pages they wrote may be past our mapping, which the file sync covers.
+	bool emptied = false;
+	if (db_lock_file(db, F_WRLCK, db->offset_rel, 0)) {
+		// Another process may have emptied the journal meanwhile.
+		size = journal_size(db->journal);
+		emptied = size < db->checkpoint_limit
+			|| (db_sync(db) && fdatasync(db->fd) == 0 && journal_truncate(db->journal));
+
+		db_lock_file(db, F_UNLCK, db->offset_rel, 0);
+	}
+
+	// A failed attempt is only made again once the journal grew as much, so
+	// that the writers do not wait for one after each write.
+	__atomic_store_n(&db->checkpoint_limit, emptied ? JOURNAL_LIMIT : size + JOURNAL_LIMIT, __ATOMIC_RELAXED);
+	pthread_rwlock_unlock(&db->lock);
+}
+
+db_return db_create(const char * const path, const uint64_t max_digits) {
+	assert(max_digits > 0);
+
+	FILE* db = fopen(path, "wb");
+	if (db == NULL)
+		return (db_return){ .errno = DB_OPEN_FAIL };
+
+	// Generate the header to print to the file.
+	//
+	// To know the size of the relocation table, we have the following:
+	// For n digits that can be stored, we have two bitmaps (2 * n).
+	// A bit stores 16 digits (2n / 16).
+	// A byte is 8 bits (2n / 16 / 8).
+	// And we pad it to a full byte using branchless programming:
+	// to ceil N / M, we do (N + M - 1) / M.
+	uint64_t bitmaps_size = 2 * CEIL_DIV(max_digits, BLOCK_SIZE * BYTE);
+
+	header_t header = {
+		.magic_number = MAGIC_NUMBER,
+		.version = VERSION,
+		.max_digits = max_digits,
+
+		// The header is 64 bytes long.
+		.offset_rel = HEADER_SIZE,
+
+		// We compute the relocation table size.
+		.offset_data = HEADER_SIZE + 2 * bitmaps_size,
+
+		// Empty padding, and no block computed yet.
+		.padding = { [COUNTERS_MARKER] = 1, [CHECKSUMS_MARKER] = 1 },
+		.computed = 0,
+		.checked = 0,
+		.hint = 0,
+	};
+
+	// Print the header.
+	bool written = fwrite(&header, sizeof(header), 1, db) == 1
+		&& fflush(db) == 0;
+
+	// The bitmaps are empty, so the file is only extended over them: the
+	// file system reads the hole as zeros without writing it.
+	written = written && ftruncate(fileno(db), header.offset_data) == 0;
+
+	// We finished creating the database.
+	fclose(db);
+
+	if (!written)
+		return (db_return){ .errno = DB_OPEN_FAIL };
+
+	return (db_return){ .errno = DB_SUCCESS };
+}
+
+db_return db_create_sharded(
+		const char * const path,
+		const uint64_t max_digits,
+		const char * const * const segments,
+		const uint64_t count) {
+	return shard_create(path, max_digits, segments, count);
+}
+
+/**
+ * @brief Opens a manifest, whose segments hold the blocks.
+ * @param path the path to the manifest
+ * @return the database to manipulate
+ */
+static db_return db_open_sharded(const char * const path) {
+	database *db = (database *)calloc(1, sizeof(database));
+	if (db == NULL)
+		return (db_return){ .errno = DB_OPEN_FAIL };
+
+	db->path = path;
+
+	db_return ret = shard_open(path, &db->shards);
+	if (ret.errno != DB_SUCCESS) {
+		free(db);
+		return ret;
+	}
+
+	return (db_return){
+		.errno = DB_SUCCESS,
+		.value = { .database = db },
+	};
+}
+
+/**
+ * @brief Closes a database that could not be opened.
+ * @param db the database to close
+ *
+ * Its journal may not have been applied yet, so it is kept as is.
+ */
+static void db_abort(database * const db) {
+	if (db->journal != NULL)
+		journal_close(db->journal);
+
+	db->journal = NULL;
+	db_close(db);
+}
+
+db_return db_open(const char * const path) {
+	// Check if file exists and we have permissions.
+	struct stat st;
+
+	if (
+			stat(path, &st) != 0
+			|| !S_ISREG(st.st_mode)
+			|| access(path, F_OK)
+			|| access(path, R_OK) != 0
+			|| access(path, W_OK) != 0
+		) return (db_return){ .errno = DB_OPEN_FAIL };
+
+	// Open the file.
+	FILE *file = fopen(path, "rb+");
+	if (file == NULL)
+		return (db_return){ .errno = DB_OPEN_FAIL };
+
+	// Read the header.
+	header_t header;
+	if (fread(&header, sizeof(header), 1, file) != 1) {
+		fclose(file);
+		return (db_return){ .errno = DB_OPEN_FAIL };
+	}
+
+	// The segments of a manifest are databases of their own.
+	if (shard_is_manifest(header.magic_number)) {
+		fclose(file);
+		return db_open_sharded(path);
+	}
+
+	// Verify the magic number and the version.
+	if (memcmp(header.magic_number, MAGIC_NUMBER, 8) != 0
+			|| header.version != VERSION) {
+		fclose(file);
+		return (db_return){ .errno = DB_OPEN_WRONG_FORMAT };
+	}
+
+	// Once we have the file, we can construct the database.
+	database *db = (database *)malloc(sizeof(database));
+
+	db->path = path;
+	db->offset_rel = header.offset_rel;
+	db->offset_data = header.offset_data;
+	db->maximum_digits = header.max_digits;
+	db->maximum_blocks = CEIL_DIV(header.max_digits, BLOCK_SIZE);
+	db->offset_bitmap = CEIL_DIV(header.max_digits, BLOCK_SIZE * BYTE);
+	db->length = st.st_size;
+
+	// We now need to mmap the file to access it.
+	int fd = fileno(file);
+	db->fd = fd;
+	db->map = (uint8_t *)mmap(
+		NULL,
+		st.st_size,
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | (POPULATE ? MAP_POPULATE : 0),
+		fd,
+		0);
+	if (db->map == MAP_FAILED) {
+		fclose(file);
+		return (db_return){ .errno = DB_OPEN_FAIL };
+	}
+
+	db_advise(db->map, db->length);
+
+	db->summaries[0].levels = 0;
+	db->summaries[1].levels = 0;
+	db->journal = NULL;
+	db->shards = NULL;
+	db->leases = NULL;
+	db->verified = NULL;
+	db->verify_fd = -1;
+	db->checkpoint_limit = JOURNAL_LIMIT;
+
+	if (pthread_rwlock_init(&db->lock, NULL) != 0) {
+		munmap(db->map, db->length);
+		fclose(file);
+		free(db);
+		return (db_return){ .errno = DB_OPEN_FAIL };
+	}
+
+	pthread_mutex_init(&db->leasing, NULL);
+	for (uint8_t k = 0; k < CHECKSUM_STRIPES; ++k)
+		pthread_mutex_init(&db->stripes[k], NULL);
+
+	for (uint8_t k = 0; k < WRITE_STRIPES; ++k)
+		pthread_mutex_init(&db->writing[k], NULL);
+
+	pthread_mutex_init(&db->verifying, NULL);
+
+	db->verify_fd = open(path, O_RDONLY);
+	if (db->verify_fd == -1) {
+		db_abort(db);
+		return (db_return){ .errno = DB_OPEN_FAIL };
+	}
+
+	// The journal is shared by the processes that opened the database.
+	db->journal = journal_open(path);
+	if (db->journal == NULL) {
+		db_abort(db);
+		return (db_return){ .errno = DB_OPEN_FAIL };
+	}
+
+	// Another process may have migrated the database while we waited for
+	// the journal, and the layout we read is then outdated. The counters
+	// change with every write, so they are not compared.
+	if (memcmp(db->map, &header, offsetof(header_t, padding) + MIGRATION_MARKER + 1) != 0) {
+		db_abort(db);
+		return db_open(path);
+	}
+
+	// A migration was interrupted, so we finish it first.
+	if (header.padding[MIGRATION_MARKER] != 0) {
+		db_return resume = db_migrate_resume(db);
+		if (resume.errno != DB_SUCCESS) {
+			db_abort(db);
+			return resume;
+		}
+	}
+
+	// We summarize the bitmaps, to find unset bits without scanning them,
+	// then apply again the writes of a previous crash.
+	if (!checksum_setup(db)
+			|| !summary_build(db, 0)
+			|| !summary_build(db, db->offset_bitmap)
+			|| !db_recover(db)) {
+		db_abort(db);
+		return (db_return){ .errno = DB_OPEN_FAIL };
+	}
+
+	return (db_return){
+		.errno = DB_SUCCESS,
+		.value = { .database = db },
+	};
+}
+
+void db_close(database * const db) {
+	if (db->shards != NULL) {
+		shard_close(db->shards);
+		free(db);
+		return;
+	}
+
+	if (db->journal != NULL) {
+		// The next open skips the words before the first uncomputed block,
+		// unless a failed migration left the bitmaps half moved.
+		uint64_t position;
+		if (db->map[offsetof(header_t, padding) + MIGRATION_MARKER] == 0
+				&& summary_find(db, 0, 0, &position))
+			hint_update(db, position < db->maximum_blocks ? position : db->maximum_blocks);
+
+		journal_checkpoint(db->journal, db_sync, db);
+		journal_close(db->journal);
+	}
+
+	if (db->leases != NULL) {
+		munmap(db->leases, sizeof(lease_table_t));
+		close(db->leases_fd);
+	}
+
+	if (db->verify_fd != -1)
+		close(db->verify_fd);
+
+	for (uint8_t k = 0; k < CHECKSUM_STRIPES; ++k)
+		pthread_mutex_destroy(&db->stripes[k]);
+
+	for (uint8_t k = 0; k < WRITE_STRIPES; ++k)
+		pthread_mutex_destroy(&db->writing[k]);
+
+	pthread_mutex_destroy(&db->verifying);
+
+	free(db->verified);
+	pthread_mutex_destroy(&db->leasing);
+	pthread_rwlock_destroy(&db->lock);
+	summary_free(&db->summaries[0]);
+	summary_free(&db->summaries[1]);
+	munmap(db->map, db->length);
+	close(db->fd);
+	free(db);
+}
+
+/**
+ * @brief Reads a position for a block.
+ * @param db the database to query
+ * @param offset if there is an offset in the relocation table to handle
+ * @return the position of a bit not set in the relocation header
+ *
+ * For the errors, it returns the error DB_READ_OUT_OF_BOUNDS which
+ * must be changed to DB_READ_NO_UNCOMPUTED/UNCHECKED by the caller.
+ */
+static db_return db_read_position(database * const db, const uint64_t offset) {
+	// The summary leads us to the first word of the bitmap that is not
+	// full, and we get the first 0 inside.
+	uint64_t position;
+	if (summary_find(db, offset, 0, &position) && position < db->maximum_blocks)
+		return (db_return){
+			.errno = DB_SUCCESS,
+			.value = { .position = position },
+		};
+
+	// Every bit is set, meaning we computed or checked every block.
+	return (db_return){ .errno = DB_READ_OUT_OF_BOUNDS };
+}
+
+
+db_return db_read_uncomputed(database * const db) {
+	if (db->shards != NULL)
+		return shard_read_position(db->shards, false);
+
+	pthread_rwlock_rdlock(&db->lock);
+	db_return ret = db_read_position(db, 0);
+	hint_update(db, ret.errno == DB_SUCCESS ? ret.value.position : db->maximum_blocks);
+	pthread_rwlock_unlock(&db->lock);
+
+	if (ret.errno == DB_SUCCESS)
+		return ret;
+
+	return (db_return){ .errno = DB_READ_NO_UNCOMPUTED };
+}
+
+db_return db_read_unchecked(database * const db) {
+	if (db->shards != NULL)
+		return shard_read_position(db->shards, true);
+
+	pthread_rwlock_rdlock(&db->lock);
+	db_return ret = db_read_position(db, db->offset_bitmap);
+	pthread_rwlock_unlock(&db->lock);
+
+	if (ret.errno == DB_SUCCESS)
+		return ret;
+
+	return (db_return){ .errno = DB_READ_NO_UNCHECKED };
+}
+
+/**
+ * @brief Reads a counter of the header.
+ * @param db the database to query
+ * @param field the offset of the counter inside the header
+ * @return the value of the counter
+ */
+static db_return db_read_counter(database * const db, const size_t field) {
+	pthread_rwlock_rdlock(&db->lock);
+	const uint64_t count = __atomic_load_n(db_counter(db, field), __ATOMIC_SEQ_CST);
+	pthread_rwlock_unlock(&db->lock);
+
+	return (db_return){
+		.errno = DB_SUCCESS,
+		.value = { .count = count },
+	};
+}
+
+db_return db_read_computed_count(database * const db) {
+	if (db->shards != NULL)
+		return shard_read_count(db->shards, false);
+
+	return db_read_counter(db, offsetof(header_t, computed));
+}
+
+db_return db_read_checked_count(database * const db) {
+	if (db->shards != NULL)
+		return shard_read_count(db->shards, true);
+
+	return db_read_counter(db, offsetof(header_t, checked));
+}
+
+db_return db_read_capacity(database * const db) {
+	if (db->shards != NULL)
+		return shard_read_capacity(db->shards);
+
+	pthread_rwlock_rdlock(&db->lock);
+	const uint64_t count = db->maximum_blocks;
+	pthread_rwlock_unlock(&db->lock);
+
+	return (db_return){
+		.errno = DB_SUCCESS,
+		.value = { .count = count },
+	};
+}
+
+db_return db_read_computed_run(database * const db, const uint64_t start) {
+	if (db->shards != NULL)
+		return shard_read_computed_run(db->shards, start);
+
+	pthread_rwlock_rdlock(&db->lock);
+
+	if (start >= db->maximum_blocks) {
+		pthread_rwlock_unlock(&db->lock);
+		return (db_return){ .errno = DB_READ_OUT_OF_BOUNDS };
+	}
+
+	// The first set bit is looked for a word at a time, and the end of the
+	// run is the first unset bit after it, found through the summary. The
+	// bytes past the bitmap are read as full, hence the bound on the start.
+	const uint64_t words = CEIL_DIV(db->maximum_blocks, WORD);
+	uint64_t first = db->maximum_blocks;
+
+	for (uint64_t w = start / WORD; w < words; ++w) {
+		uint64_t word = bitmap_word(db, 0, w);
+		if (w == start / WORD && start % WORD != 0)
+			word &= FULL >> (start % WORD);
+
+		if (word != 0) {
+			first = WORD * w + __builtin_clzll(word);
+			break;
+		}
+	}
+
+	uint64_t end = db->maximum_blocks;
+	if (first < db->maximum_blocks && summary_find(db, 0, first, &end) && end > db->maximum_blocks)
+		end = db->maximum_blocks;
+
+	pthread_rwlock_unlock(&db->lock);
+
+	if (first >= db->maximum_blocks)
+		return (db_return){ .errno = DB_READ_NOT_READY };
+
+	return (db_return){
+		.errno = DB_SUCCESS,
+		.value = { .range = { .position = first, .count = end - first } },
+	};
+}
+
+/**
+ * @brief Reads a computed/checked flag.
+ * @param db the database to query
+ * @param position the position of the block to query
+ * @param offset an optional offset inside the relocation table
+ * @return whether the block at position has its flag set
+ */
+static db_return db_read_flag(database * const db, const uint64_t position, const uint64_t offset) {
+	if (position >= db->maximum_blocks)
+		return (db_return){ .errno = DB_READ_OUT_OF_BOUNDS };
+
+	pthread_rwlock_rdlock(&db->lock);
+	const bool is_set = bitmap_bit(db->map + db->offset_rel + offset, position);
+	pthread_rwlock_unlock(&db->lock);
+
+	return (db_return){
+		.errno = DB_SUCCESS,
+		.value = { .boolean = is_set },
+	};
+}
+
+
+inline db_return db_read_is_computed(database * const db, const uint64_t position) {
+	if (db->shards != NULL)
+		return shard_read_flag(db->shards, position, false);
+
+	return db_read_flag(db, position, 0);
+}
+
+inline db_return db_read_is_checked(database * const db, const uint64_t position) {
+	if (db->shards != NULL)
+		return shard_read_flag(db->shards, position, true);
+
+	return db_read_flag(db, position, db->offset_bitmap);
+}
+
+db_return db_read(database * const db, const uint64_t position) {
+	uint64_t block;
+	db_return ret = db_read_range(db, position, 1, &block);
+
+	if (ret.errno != DB_SUCCESS)
+		return ret;
+
+	return (db_return){
+		.errno = DB_SUCCESS,
+		.value = { .block = block },
+	};
+}
+
+db_return db_read_range(
+		database * const db,
+		const uint64_t first,
+		const uint64_t count,
+		uint64_t * const out) {
+	if (db->shards != NULL)
+		return shard_read_range(db->shards, first, count, out);
+
+	if (count > db->maximum_blocks || first > db->maximum_blocks - count)
+		return (db_return){ .errno = DB_READ_OUT_OF_BOUNDS };
+
+	pthread_rwlock_rdlock(&db->lock);
+
+	bool ready = !bitmap_any(db, 0, first, count, false);
+
+	// Another process may have written the blocks past our mapping.
+	if (ready)
+		ready = db_reserve(db, db->offset_data + BYTE * (first + count)).errno == DB_SUCCESS;
+
+	// The blocks are read after their flags, which were set after them.
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	const bool valid = !ready || checksum_check(db, first, count);
+	if (ready && valid)
+		db_copy_blocks(out, db->map + db->offset_data + BYTE * first, count);
+
+	pthread_rwlock_unlock(&db->lock);
+
+	if (!ready)
+		return (db_return){ .errno = DB_READ_NOT_READY };
+
+	if (!valid)
+		return (db_return){ .errno = DB_READ_CORRUPTED };
+
+	return (db_return){ .errno = DB_SUCCESS };
+}
+
+/**
+ * @brief Grows the file and its mapping.
+ * @param db the database to grow, locked exclusively
+ * @param size the new minimum size of the file
+ * @return whether the file and its mapping grew
+ *
+ * The file grows geometrically, by its own length between GROWTH_MIN and
+ * GROWTH_MAX, so writing the blocks in order resizes it a logarithmic
+ * number of times. The new space is allocated at once, and the file never
+ * grows past the last block.
+ */
+static db_return db_grow(database * const db, const uint64_t size) {
+	struct stat st;
+	if (fstat(db->fd, &st) == -1)
+		return (db_return){ .errno = DB_MIGRATE_FAIL };
+
+	const uint64_t current = st.st_size;
+	const uint64_t maximum = db->offset_data + BYTE * db->maximum_blocks;
+
+	uint64_t length = current;
+	if (size > current) {
+		const uint64_t growth = current < GROWTH_MIN
+			? GROWTH_MIN
+			: current > GROWTH_MAX ? GROWTH_MAX : current;
+
+		length = current + growth < maximum ? current + growth : maximum;
+		length = length > size ? length : size;
+
+		// Not every file system can allocate, but every one can truncate. A
+		// file system that can allocate, but has no space left, fails.
+		if (fallocate(db->fd, 0, current, length - current) == -1) {
+			const int error = db_last_error();
+			if ((error != EOPNOTSUPP && error != ENOSYS) || ftruncate(db->fd, length) == -1)
+				return (db_return){ .errno = DB_MIGRATE_FAIL };
+		}
+	}
+
+	uint8_t *map = (uint8_t *)mremap(db->map, db->length, length, MREMAP_MAYMOVE);
+	if (map == MAP_FAILED)
+		return (db_return){ .errno = DB_MIGRATE_FAIL };
+
+	db->map = map;
+	db->length = length;
+	db_advise(db->map, db->length);
+
+	return (db_return){ .errno = DB_SUCCESS };
+}
+
+/**
+ * @brief Resizes the data portion of the database to be bigger
+ * @param db the database to grow, locked exclusively
+ * @param size the new minimum size of the file
+ * @return whether the migration succeeded
+ */
+static db_return db_resize(database * const db, const uint64_t size) {
+	// Another process may have grown the file, which must never shrink.
+	if (!db_lock_file(db, F_WRLCK, 0, HEADER_SIZE))
+		return (db_return){ .errno = DB_LOCK_FAIL };
+
+	db_return ret = db_grow(db, size);
+
+	db_lock_file(db, F_UNLCK, 0, HEADER_SIZE);
+	return ret;
+}
+
+/**
+ * @brief Makes sure the file is long enough.
+ * @param db the database to grow, locked shared
+ * @param size the minimum size of the file
+ * @return whether the file is long enough
+ *
+ * The mapping may move, so the shared lock is traded for the exclusive one
+ * while the file grows.
+ */
+static db_return db_reserve(database * const db, const uint64_t size) {
+	if (size <= db->length)
+		return (db_return){ .errno = DB_SUCCESS };
+
+	pthread_rwlock_unlock(&db->lock);
+	pthread_rwlock_wrlock(&db->lock);
+
+	// Another thread may have grown the file in the meantime.
+	db_return ret = { .errno = DB_SUCCESS };
+	if (size > db->length)
+		ret = db_resize(db, size);
+
+	pthread_rwlock_unlock(&db->lock);
+	pthread_rwlock_rdlock(&db->lock);
+
+	return ret;
+}
+
+/**
+ * @brief Gets the write locks of the chunks of a range.
+ * @param first the first block of the range, which is not empty
+ * @param count the number of blocks of the range
+ * @return the locks, one bit each
+ */
+static uint64_t write_stripes(const uint64_t first, const uint64_t count) {
+	const uint64_t begin = first / CHECKSUM_BLOCKS;
+	const uint64_t end = (first + count - 1) / CHECKSUM_BLOCKS;
+
+	if (end - begin >= WRITE_STRIPES - 1)
+		return ~(uint64_t)0;
+
+	uint64_t stripes = 0;
+	for (uint64_t c = begin; c <= end; ++c)
+		stripes |= (uint64_t)1 << (c % WRITE_STRIPES);
+
+	return stripes;
+}
+
+/**
+ * @brief Serializes the threads of this process writing a range.
+ * @param db the database
+ * @param stripes the locks to take, as returned by write_stripes()
+ *
+ * The locks are taken in the same order by every thread, so that the
+ * threads writing overlapping ranges cannot wait for each other.
+ */
+static void write_lock(database * const db, const uint64_t stripes) {
+	for (uint8_t k = 0; k < WRITE_STRIPES; ++k)
+		if (stripes >> k & 1)
+			pthread_mutex_lock(&db->writing[k]);
+}
+
+/**
+ * @brief Lets the other threads of this process write a range.
+ * @param db the database
+ * @param stripes the locks taken by write_lock()
+ */
+static void write_unlock(database * const db, const uint64_t stripes) {
+	for (uint8_t k = 0; k < WRITE_STRIPES; ++k)
+		if (stripes >> k & 1)
+			pthread_mutex_unlock(&db->writing[k]);
+}
+
+/**
+ * @brief Writes consecutive computed blocks.
+ * @param db the database to update, locked shared
+ * @param first the position of the first block
+ * @param count the number of blocks
+ * @param digits the count 16-digit blocks
+ * @return only if no block of the range has been computed yet
+ */
+static db_return db_write_blocks(
+		database * const db,
+		const uint64_t first,
+		const uint64_t count,
+		const uint64_t * const digits) {
+	// The range is written as a whole or not at all.
+	if (bitmap_any(db, 0, first, count, true))
+		return (db_return){ .errno = DB_WRITE_ALREADY_COMPUTED };
+
+	// The file is extended once for the whole range.
+	db_return reserve = db_reserve(db, db->offset_data + BYTE * (first + count));
+	if (reserve.errno != DB_SUCCESS)
+		return reserve;
+
+	// The file locks are shared by the threads of this process, which the
+	// stripes exclude instead. They are taken once the file is extended,
+	// which waits for every thread to leave the mapping.
+	const uint64_t stripes = write_stripes(first, count);
+	write_lock(db, stripes);
+
+	// The other processes cannot write the same blocks meanwhile.
+	const uint64_t start = db->offset_data + BYTE * first;
+	if (!db_lock_file(db, F_WRLCK, start, BYTE * count)) {
+		write_unlock(db, stripes);
+		return (db_return){ .errno = DB_LOCK_FAIL };
 	}
 
-	// We then write the block.
-	printf("#2 Writing %lx\n", digits);
-	for (uint8_t shift = BYTE; shift > 0; --shift) {
-		const uint8_t digit = digits >> ((shift - 1) * BYTE);
-		printf("#1 Write %x at %ld for %ld\n", digit, db->offset_data + position / 2 + BYTE - shift, position);
-		db->map[db->offset_data + position / 2 + BYTE - shift] = digit;
+	db_return ret = { .errno = DB_SUCCESS };
+	if (bitmap_any(db, 0, first, count, true)) {
+		ret.errno = DB_WRITE_ALREADY_COMPUTED;
+	} else {
+		checksum_copy(db, first, count, digits);
+
+		// The flags are written after the blocks are durable.
+		if (!journal_commit(db->journal, JOURNAL_COMPUTED, first, count, digits))
+			ret.errno = DB_JOURNAL_FAIL;
+		else if (!bitmap_set(db, 0, first, count))
+			ret.errno = DB_WRITE_ALREADY_COMPUTED;
 	}
-	
-	// We then write the flag.
-	db_return set_flag = db_write_flag(db, position, 0);
 
-	return set_flag;
+	db_lock_file(db, F_UNLCK, start, BYTE * count);
+	write_unlock(db, stripes);
+	return ret;
+}
+
+db_return db_write_computed(database * const db, const uint64_t position, const uint64_t digits) {
+	return db_write_range(db, position, 1, &digits);
 }
 
 db_return db_write_checked(database * const db, const uint64_t position) {
-	db_return is_checked = db_read_is_checked(db, position);
-	if (is_checked.errno != DB_SUCCESS)
-		return is_checked;
+	return db_write_checked_range(db, position, 1);
+}
+
+db_return db_write_range(
+		database * const db,
+		const uint64_t first,
+		const uint64_t count,
+		const uint64_t * const digits) {
+	if (db->shards != NULL)
+		return shard_write_range(db->shards, first, count, digits);
+
+	if (count > db->maximum_blocks || first > db->maximum_blocks - count)
+		return (db_return){ .errno = DB_WRITE_OUT_OF_BOUNDS };
+
+	// An empty range would lock the file up to its end.
+	if (count == 0)
+		return (db_return){ .errno = DB_SUCCESS };
+
+	pthread_rwlock_rdlock(&db->lock);
+	db_return ret = db_write_blocks(db, first, count, digits);
+	pthread_rwlock_unlock(&db->lock);
+
+	db_checkpoint(db);
+	return ret;
+}
+
+db_return db_write_checked_range(
+		database * const db,
+		const uint64_t first,
+		const uint64_t count) {
+	if (db->shards != NULL)
+		return shard_write_checked_range(db->shards, first, count);
+
+	if (count > db->maximum_blocks || first > db->maximum_blocks - count)
+		return (db_return){ .errno = DB_WRITE_OUT_OF_BOUNDS };
+
+	// An empty range would lock the file up to its end.
+	if (count == 0)
+		return (db_return){ .errno = DB_SUCCESS };
+
+	pthread_rwlock_rdlock(&db->lock);
+
+	// The flags are shared with the other writers, but not with a process
+	// applying the journal again.
+	const uint64_t start = db->offset_rel + db->offset_bitmap + first / BYTE;
+	const uint64_t length = CEIL_DIV(first + count, BYTE) - first / BYTE;
+
+	// The threads of this process checking the same blocks wait for each
+	// other, so that only one of them journals them.
+	const uint64_t stripes = write_stripes(first, count);
+	write_lock(db, stripes);
+
+	db_return ret = { .errno = DB_SUCCESS };
+	if (!db_lock_file(db, F_RDLCK, start, length))
+		ret.errno = DB_LOCK_FAIL;
+	else if (bitmap_any(db, db->offset_bitmap, first, count, true))
+		ret.errno = DB_WRITE_ALREADY_CHECKED;
+	else if (!journal_commit(db->journal, JOURNAL_CHECKED, first, count, NULL))
+		ret.errno = DB_JOURNAL_FAIL;
+	else if (!bitmap_set(db, db->offset_bitmap, first, count))
+		ret.errno = DB_WRITE_ALREADY_CHECKED;
+
+	if (ret.errno != DB_LOCK_FAIL)
+		db_lock_file(db, F_UNLCK, start, length);
+
+	write_unlock(db, stripes);
+
+	pthread_rwlock_unlock(&db->lock);
+
+	db_checkpoint(db);
+	return ret;
+}
+
+db_return db_scrub(database * const db) {
+	if (db->shards != NULL)
+		return shard_scrub(db->shards);
+
+	for (uint64_t c = 0;; ++c) {
+		// The lock is taken again for each chunk, to let the file grow.
+		pthread_rwlock_rdlock(&db->lock);
+
+		const bool done = !checksum_enabled(db) || c >= CEIL_DIV(db->maximum_blocks, CHECKSUM_BLOCKS);
+		const bool valid = done || checksum_verify(db, c);
+
+		pthread_rwlock_unlock(&db->lock);
+
+		if (done)
+			return (db_return){ .errno = DB_SUCCESS };
+
+		if (!valid)
+			return (db_return){
+				.errno = DB_READ_CORRUPTED,
+				.value = { .position = CHECKSUM_BLOCKS * c },
+			};
+	}
+}
+
+/**
+ * @brief Maps the lease table, creating it if needed.
+ * @param db the database
+ * @return whether the table is mapped
+ */
+static bool lease_open(database * const db) {
+	if (db->leases != NULL)
+		return true;
+
+	char file[strlen(db->path) + sizeof(LEASE_SUFFIX)];
+	strcpy(file, db->path);
+	strcat(file, LEASE_SUFFIX);
+
+	const int fd = open(file, O_RDWR | O_CREAT, 0644);
+	if (fd == -1)
+		return false;
+
+	// A new table is empty, as it is filled with zeros.
+	struct stat st;
+	if (fstat(fd, &st) == -1
+			|| ((uint64_t)st.st_size < sizeof(lease_table_t)
+				&& ftruncate(fd, sizeof(lease_table_t)) != 0)) {
+		close(fd);
+		return false;
+	}
+
+	lease_table_t *leases = (lease_table_t *)mmap(
+		NULL,
+		sizeof(lease_table_t),
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED,
+		fd,
+		0);
+	if (leases == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+
+	db->leases = leases;
+	db->leases_fd = fd;
+	return true;
+}
+
+/**
+ * @brief Locks the lease table against the other processes.
+ * @param db the database, whose table is mapped
+ * @param type F_WRLCK or F_UNLCK
+ * @return whether the lock is held
+ */
+static bool lease_lock(const database * const db, const short type) {
+	struct flock lock = {
+		.l_type = type,
+		.l_whence = SEEK_SET,
+		.l_start = 0,
+		.l_len = 0,
+	};
+
+	return fcntl(db->leases_fd, F_OFD_SETLKW, &lock) != -1;
+}
+
+/**
+ * @brief Drops the leases that are no longer needed.
+ * @param db the database, whose table is locked
+ * @param now the current time, in seconds since the epoch
+ */
+static void lease_prune(database * const db, const uint64_t now) {
+	lease_table_t * const table = db->leases;
+
+	// A table torn by a crash is dropped, the leases only avoid duplicates.
+	if (table->used > LEASE_SLOTS)
+		table->used = 0;
+
+	uint64_t kept = 0;
+	for (uint64_t i = 0; i < table->used; ++i) {
+		const lease_t lease = table->leases[i];
+
+		if (lease.expiry <= now
+				|| lease.count > db->maximum_blocks
+				|| lease.first > db->maximum_blocks - lease.count
+				|| !bitmap_any(db, 0, lease.first, lease.count, false))
+			continue;
+
+		table->leases[kept++] = lease;
+	}
+
+	table->used = kept;
+}
+
+/**
+ * @brief Finds the first uncomputed blocks that are not leased.
+ * @param db the database, whose table is locked and pruned
+ * @param count the maximum number of blocks
+ * @param position the position of the first block
+ * @param length the number of blocks, at most count
+ * @param index where the lease goes inside the table
+ * @return whether there is such a block
+ */
+static bool lease_find(
+		database * const db,
+		const uint64_t count,
+		uint64_t * const position,
+		uint64_t * const length,
+		uint64_t * const index) {
+	const lease_table_t * const table = db->leases;
+	const uint8_t * const bitmap = db->map + db->offset_rel;
+	uint64_t p, i = 0;
+
+	if (!summary_find(db, 0, 0, &p))
+		return false;
+
+	// The leases are sorted, so we skip them along with the bitmap.
+	for (;;) {
+		if (p >= db->maximum_blocks)
+			return false;
+
+		while (i < table->used && table->leases[i].first + table->leases[i].count <= p)
+			++i;
+
+		if (i == table->used || table->leases[i].first > p)
+			break;
+
+		const uint64_t end = table->leases[i].first + table->leases[i].count;
+		if (!summary_find(db, 0, end, &p))
+			return false;
+	}
+
+	// The range stops at the next computed or leased block.
+	uint64_t limit = i < table->used ? table->leases[i].first : db->maximum_blocks;
+	if (count < limit - p)
+		limit = p + count;
+
+	uint64_t end = p + 1;
+	while (end < limit && !bitmap_bit(bitmap, end))
+		++end;
+
+	*position = p;
+	*length = end - p;
+	*index = i;
+	return true;
+}
+
+db_return db_claim_uncomputed(database * const db, const uint64_t count, const uint64_t ttl) {
+	assert(count > 0);
+
+	if (db->shards != NULL)
+		return shard_claim_uncomputed(db->shards, count, ttl);
+
+	pthread_mutex_lock(&db->leasing);
+
+	if (!lease_open(db) || !lease_lock(db, F_WRLCK)) {
+		pthread_mutex_unlock(&db->leasing);
+		return (db_return){ .errno = DB_LEASE_FAIL };
+	}
+
+	pthread_rwlock_rdlock(&db->lock);
+
+	lease_table_t * const table = db->leases;
+	const uint64_t now = (uint64_t)time(NULL);
+	lease_prune(db, now);
+
+	uint64_t position, length, index;
+	db_return ret = { .errno = DB_SUCCESS };
+
+	if (!lease_find(db, count, &position, &length, &index)) {
+		ret.errno = DB_READ_NO_UNCOMPUTED;
+	} else if (table->used == LEASE_SLOTS) {
+		ret.errno = DB_LEASE_FAIL;
+	} else {
+		memmove(&table->leases[index + 1], &table->leases[index],
+			(table->used - index) * sizeof(lease_t));
+
+		table->leases[index] = (lease_t){
+			.first = position,
+			.count = length,
+			.expiry = now + ttl,
+		};
+		++table->used;
+
+		ret.value.range.position = position;
+		ret.value.range.count = length;
+	}
+
+	pthread_rwlock_unlock(&db->lock);
+	lease_lock(db, F_UNLCK);
+	pthread_mutex_unlock(&db->leasing);
+
+	return ret;
+}
+
+/*
+ * Migrations.
+ *
+ * Changing the capacity changes the size of both bitmaps, so the checked
+ * bitmap and the data move inside the file. They are moved in chunks, from
+ * the end when they move towards the end, so that a chunk never overwrites
+ * the part of the section that is still to be moved.
+ *
+ * Before a chunk is copied, it is staged inside the sidecar `.migration`
+ * file and synced, and a marker in the header padding tells that a
+ * migration is in progress. After a crash, the last staged chunk is copied
+ * again from the sidecar, and the migration goes on from the next chunk.
+ * Two slots are used in turn, so that a torn staging write leaves the
+ * previous chunk in the other slot.
+ */
+
+/** The suffix of the migration sidecar, after the database path. */
+#define MIGRATION_SUFFIX ".migration"
+
+/** The magic number of the migration sidecar. */
+#define MIGRATION_MAGIC "PiMG\x24\x3F\x6A\x88"
+
+/** The number of bytes moved at once. */
+#define MIGRATION_CHUNK (16ULL << 20)
+
+/** The number of staging slots of the sidecar. */
+#define MIGRATION_SLOTS 2
+
+#pragma pack(push, 1)
+/** The header of the migration sidecar. */
+typedef struct {
+	/// The magic number.
+	uint8_t magic_number[8];
+
+	/// The maximum number of digits before the migration.
+	uint64_t from;
 
-	if (is_checked.value.boolean != false)
-		return (db_return){ .errno = DB_WRITE_ALREADY_CHECKED };
+	/// The maximum number of digits after the migration.
+	uint64_t to;
+
+	/// The number of bytes of data to move.
+	uint64_t stored;
+} migration_t;
+
+/** A chunk staged inside the migration sidecar. */
+typedef struct {
+	/// The index of the move.
+	uint64_t move;
+
+	/// The index of the chunk inside the move.
+	uint64_t chunk;
+
+	/// The number of bytes of the chunk.
+	uint64_t length;
+
+	/// The checksum of the slot, to detect a torn staging.
+	uint64_t checksum;
+} slot_t;
+#pragma pack(pop)
+
+/** A section to move. */
+typedef struct {
+	/// The offset of the section before the move.
+	uint64_t from;
+
+	/// The offset of the section after the move.
+	uint64_t to;
+
+	/// The number of bytes of the section.
+	uint64_t length;
+} move_t;
+
+/** The state of a migration. */
+typedef struct {
+	/// The maximum number of digits after the migration.
+	uint64_t digits;
+
+	/// The offset of the data after the migration.
+	uint64_t offset_data;
+
+	/// The size of a bitmap after the migration.
+	uint64_t offset_bitmap;
+
+	/// The sections to move, in order.
+	move_t moves[2];
+
+	/// The number of sections to move.
+	uint8_t count;
+
+	/// The migration sidecar file descriptor.
+	int fd;
+} migration_state_t;
+
+/**
+ * @brief Plans the moves of a migration.
+ * @param db the database, with its layout before the migration
+ * @param info the migration
+ * @param fd the migration sidecar file descriptor
+ * @return the state of the migration
+ *
+ * The plan only depends on the sidecar header, so it is the same when a
+ * migration is resumed.
+ */
+static migration_state_t migration_plan(
+		const database * const db,
+		const migration_t * const info,
+		const int fd) {
+	migration_state_t state = {
+		.digits = info->to,
+		.offset_bitmap = CEIL_DIV(info->to, BLOCK_SIZE * BYTE),
+		.fd = fd,
+	};
+
+	// The same layout as db_create(): two bitmaps, then as much unused.
+	state.offset_data = db->offset_rel + 4 * state.offset_bitmap;
+
+	const move_t data = {
+		.from = db->offset_data,
+		.to = state.offset_data,
+		.length = info->stored,
+	};
+
+	const move_t checked = {
+		.from = db->offset_rel + db->offset_bitmap,
+		.to = db->offset_rel + state.offset_bitmap,
+		.length = db->offset_bitmap < state.offset_bitmap
+			? db->offset_bitmap
+			: state.offset_bitmap,
+	};
+
+	// Growing, the data makes room for the checked bitmap. Shrinking, the
+	// checked bitmap moves first, out of the way of the data.
+	const bool growing = state.offset_bitmap > db->offset_bitmap;
+	state.moves[0] = growing ? data : checked;
+	state.moves[1] = growing ? checked : data;
+	state.count = state.offset_bitmap == db->offset_bitmap ? 0 : 2;
+
+	return state;
+}
+
+/**
+ * @brief Gets the range of a chunk of a move.
+ * @param move the move
+ * @param chunk the index of the chunk
+ * @param start the offset of the chunk inside the section, 0 past the last chunk
+ * @param length the number of bytes of the chunk, 0 past the last chunk
+ * @return whether the move has such a chunk
+ */
+static bool migration_chunk(
+		const move_t * const move,
+		const uint64_t chunk,
+		uint64_t * const start,
+		uint64_t * const length) {
+	*start = 0;
+	*length = 0;
+
+	if (chunk >= CEIL_DIV(move->length, MIGRATION_CHUNK))
+		return false;
+
+	const uint64_t begin = MIGRATION_CHUNK * chunk;
+	*length = move->length - begin < MIGRATION_CHUNK ? move->length - begin : MIGRATION_CHUNK;
+
+	// Towards the end of the file, the chunks are taken from the end.
+	*start = move->to > move->from ? move->length - begin - *length : begin;
+	return true;
+}
+
+/**
+ * @brief Gets the offset of a staging slot inside the sidecar.
+ * @param slot the index of the slot
+ * @return the offset of the slot
+ */
+static inline uint64_t migration_slot(const uint64_t slot) {
+	return sizeof(migration_t) + (slot % MIGRATION_SLOTS) * (sizeof(slot_t) + MIGRATION_CHUNK);
+}
+
+/**
+ * @brief Computes the checksum of a staged chunk.
+ * @param slot the slot, whose checksum is ignored
+ * @param bytes the bytes of the chunk
+ * @return the checksum
+ */
+static uint64_t migration_checksum(const slot_t * const slot, const uint8_t * const bytes) {
+	return fnv(fnv(FNV_BASIS, slot, offsetof(slot_t, checksum)), bytes, slot->length);
+}
+
+/**
+ * @brief Copies a chunk to its new place, and syncs it.
+ * @param db the database
+ * @param to the new offset of the chunk
+ * @param bytes the bytes of the chunk
+ * @param length the number of bytes of the chunk
+ * @return whether the chunk is durable at its new place
+ */
+static bool migration_copy(
+		database * const db,
+		const uint64_t to,
+		const uint8_t * const bytes,
+		const uint64_t length) {
+	memmove(db->map + to, bytes, length);
+
+	// msync() wants an address aligned on a page.
+	const uint64_t page = sysconf(_SC_PAGESIZE);
+	const uint64_t begin = to / page * page;
+
+	return msync(db->map + begin, to + length - begin, MS_SYNC) == 0;
+}
+
+/**
+ * @brief Moves the sections, from a given chunk to the end.
+ * @param db the database, with its layout before the migration
+ * @param state the state of the migration
+ * @param move the index of the first move
+ * @param chunk the index of the first chunk inside the move
+ * @param slot the index of the first staging slot
+ * @return whether every section was moved
+ */
+static bool migration_move(
+		database * const db,
+		const migration_state_t * const state,
+		uint8_t move,
+		uint64_t chunk,
+		uint64_t slot) {
+	for (; move < state->count; ++move, chunk = 0) {
+		const move_t * const section = &state->moves[move];
+
+		uint64_t start, length;
+		for (; migration_chunk(section, chunk, &start, &length); ++chunk, ++slot) {
+			const uint8_t * const bytes = db->map + section->from + start;
+
+			slot_t staged = { .move = move, .chunk = chunk, .length = length };
+			staged.checksum = migration_checksum(&staged, bytes);
+
+			// The chunk is durable inside the sidecar before it is copied.
+			const uint64_t offset = migration_slot(slot);
+			if (pwrite(state->fd, &staged, sizeof(staged), offset) != sizeof(staged)
+					|| pwrite(state->fd, bytes, length, offset + sizeof(staged)) != (ssize_t)length
+					|| fdatasync(state->fd) != 0
+					|| !migration_copy(db, section->to + start, bytes, length))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Finishes a migration, once the sections are moved.
+ * @param db the database, with its layout before the migration
+ * @param state the state of the migration
+ * @return whether the database has its new layout
+ */
+static db_return migration_finish(database * const db, const migration_state_t * const state) {
+	const uint64_t bitmap = db->offset_bitmap;
+	const uint64_t next = state->offset_bitmap;
+	uint8_t * const bitmaps = db->map + db->offset_rel;
+
+	// Growing, the new bytes of both bitmaps are cleared.
+	if (next > bitmap) {
+		memset(bitmaps + bitmap, 0, next - bitmap);
+		memset(bitmaps + next + bitmap, 0, next - bitmap);
+	}
+
+	header_t header;
+	memcpy(&header, db->map, sizeof(header));
+	header.max_digits = state->digits;
+	header.offset_data = state->offset_data;
+	header.padding[MIGRATION_MARKER] = 0;
+	header.padding[CHECKSUMS_MARKER] = 0;
+	memcpy(db->map, &header, sizeof(header));
+
+	if (!db_sync(db))
+		return (db_return){ .errno = DB_MIGRATE_FAIL };
+
+	// The data past the new capacity is dropped.
+	const uint64_t end = state->offset_data + BYTE * CEIL_DIV(state->digits, BLOCK_SIZE);
+	if (db->length > end) {
+		uint8_t *map = (uint8_t *)mremap(db->map, db->length, end, MREMAP_MAYMOVE);
+		if (map == MAP_FAILED || ftruncate(db->fd, end) != 0)
+			return (db_return){ .errno = DB_MIGRATE_FAIL };
+
+		db->map = map;
+		db->length = end;
+	}
+
+	db->maximum_digits = state->digits;
+	db->maximum_blocks = CEIL_DIV(state->digits, BLOCK_SIZE);
+	db->offset_bitmap = next;
+	db->offset_data = state->offset_data;
+
+	// The checksums moved with the sections, so they are computed again,
+	// and only trusted once they are durable.
+	if (!checksum_setup(db))
+		return (db_return){ .errno = DB_MIGRATE_FAIL };
+
+	checksum_rebuild(db, 0, db->maximum_blocks);
+	if (!db_sync(db))
+		return (db_return){ .errno = DB_MIGRATE_FAIL };
+
+	db->map[offsetof(header_t, padding) + CHECKSUMS_MARKER] = 1;
+	return (db_return){ .errno = DB_SUCCESS };
+}
+
+/**
+ * @brief Gets the path of the migration sidecar.
+ * @param db the database
+ * @param file the path, of strlen(db->path) + sizeof(MIGRATION_SUFFIX) bytes
+ */
+static void migration_path(const database * const db, char * const file) {
+	strcpy(file, db->path);
+	strcat(file, MIGRATION_SUFFIX);
+}
+
+/**
+ * @brief Runs a migration from a given chunk, then removes its sidecar.
+ * @param db the database, with its layout before the migration
+ * @param state the state of the migration
+ * @param move the index of the first move
+ * @param chunk the index of the first chunk inside the move
+ * @param slot the index of the first staging slot
+ * @return whether the database has its new layout
+ */
+static db_return migration_run(
+		database * const db,
+		const migration_state_t * const state,
+		const uint8_t move,
+		const uint64_t chunk,
+		const uint64_t slot) {
+	// Every section must fit inside the file at its new place.
+	uint64_t size = 0;
+	for (uint8_t m = 0; m < state->count; ++m) {
+		const uint64_t end = state->moves[m].to + state->moves[m].length;
+		size = end > size ? end : size;
+	}
+
+	if (size > db->length) {
+		db_return grow = db_grow(db, size);
+		if (grow.errno != DB_SUCCESS)
+			return grow;
+	}
+
+	if (!migration_move(db, state, move, chunk, slot))
+		return (db_return){ .errno = DB_MIGRATE_FAIL };
+
+	db_return ret = migration_finish(db, state);
+	if (ret.errno != DB_SUCCESS)
+		return ret;
+
+	char file[strlen(db->path) + sizeof(MIGRATION_SUFFIX)];
+	migration_path(db, file);
+	unlink(file);
+
+	return ret;
+}
+
+/**
+ * @brief Finishes an interrupted migration.
+ * @param db the database, with its layout before the migration
+ * @return whether the database has its new layout
+ */
+static db_return db_migrate_resume(database * const db) {
+	if (!journal_acquire(db->journal))
+		return (db_return){ .errno = DB_LOCK_FAIL };
+
+	char file[strlen(db->path) + sizeof(MIGRATION_SUFFIX)];
+	migration_path(db, file);
+
+	migration_t info;
+	const int fd = open(file, O_RDWR);
+	uint8_t *bytes = (uint8_t *)malloc(MIGRATION_CHUNK);
+
+	if (fd == -1
+			|| bytes == NULL
+			|| pread(fd, &info, sizeof(info), 0) != sizeof(info)
+			|| memcmp(info.magic_number, MIGRATION_MAGIC, 8) != 0
+			|| info.from != db->maximum_digits) {
+		if (fd != -1)
+			close(fd);
+
+		free(bytes);
+		journal_release(db->journal);
+		return (db_return){ .errno = DB_MIGRATE_FAIL };
+	}
+
+	const migration_state_t state = migration_plan(db, &info, fd);
+
+	// The last chunk staged is in the slot with the greatest chunk, as long
+	// as its staging is complete.
+	slot_t last = { 0 };
+	uint8_t found = MIGRATION_SLOTS;
+
+	// A slot naming a chunk the plan does not have is as good as empty.
+	for (uint8_t s = 0; s < MIGRATION_SLOTS; ++s) {
+		slot_t staged;
+		uint64_t start, length;
+		if (pread(fd, &staged, sizeof(staged), migration_slot(s)) != sizeof(staged)
+				|| staged.move >= state.count
+				|| !migration_chunk(&state.moves[staged.move], staged.chunk, &start, &length)
+				|| staged.length != length
+				|| pread(fd, bytes, staged.length, migration_slot(s) + sizeof(staged))
+					!= (ssize_t)staged.length
+				|| staged.checksum != migration_checksum(&staged, bytes))
+			continue;
+
+		if (found == MIGRATION_SLOTS
+				|| staged.move > last.move
+				|| (staged.move == last.move && staged.chunk > last.chunk)) {
+			last = staged;
+			found = s;
+		}
+	}
+
+	// The copy of the last staged chunk may be incomplete, so it is copied
+	// again, and the migration goes on from the next chunk.
+	db_return ret = { .errno = DB_SUCCESS };
+	uint8_t move = 0;
+	uint64_t chunk = 0;
+
+	if (found != MIGRATION_SLOTS) {
+		uint64_t start, length;
+
+		if (!migration_chunk(&state.moves[last.move], last.chunk, &start, &length)
+				|| pread(fd, bytes, last.length, migration_slot(found) + sizeof(last))
+					!= (ssize_t)last.length
+				|| !migration_copy(db, state.moves[last.move].to + start, bytes, last.length))
+			ret.errno = DB_MIGRATE_FAIL;
+
+		move = last.move;
+		chunk = last.chunk + 1;
+	}
+
+	free(bytes);
+
+	if (ret.errno == DB_SUCCESS)
+		ret = migration_run(db, &state, move, chunk, found + 1);
+
+	close(fd);
+	journal_release(db->journal);
+	return ret;
+}
+
+db_return db_migrate(database * const db, const uint64_t size) {
+	// The segments would have to be split again, which is not supported.
+	if (size == 0 || db->shards != NULL)
+		return (db_return){ .errno = DB_MIGRATE_FAIL };
+
+	pthread_rwlock_wrlock(&db->lock);
+
+	// The other processes would keep the old layout.
+	if (!journal_acquire(db->journal)) {
+		pthread_rwlock_unlock(&db->lock);
+		return (db_return){ .errno = DB_LOCK_FAIL };
+	}
+
+	const uint64_t blocks = CEIL_DIV(size, BLOCK_SIZE);
+	const uint64_t stored = db->length > db->offset_data ? db->length - db->offset_data : 0;
+
+	migration_t info = {
+		.magic_number = MIGRATION_MAGIC,
+		.from = db->maximum_digits,
+		.to = size,
+		.stored = stored < BYTE * blocks ? stored : BYTE * blocks,
+	};
+
+	char file[strlen(db->path) + sizeof(MIGRATION_SUFFIX)];
+	migration_path(db, file);
+
+	db_return ret = { .errno = DB_SUCCESS };
+	int fd = -1;
+
+	// The blocks past the new capacity must not hold anything. Then the
+	// journal is emptied, as the new layout does not change the positions.
+	if (blocks < db->maximum_blocks
+			&& (bitmap_any(db, 0, blocks, db->maximum_blocks - blocks, true)
+				|| bitmap_any(db, db->offset_bitmap, blocks, db->maximum_blocks - blocks, true)))
+		ret.errno = DB_MIGRATE_FAIL;
+	else if (!db_sync(db) || !journal_truncate(db->journal))
+		ret.errno = DB_JOURNAL_FAIL;
+	else if ((fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1
+			|| pwrite(fd, &info, sizeof(info), 0) != sizeof(info)
+			|| fdatasync(fd) != 0)
+		ret.errno = DB_MIGRATE_FAIL;
+
+	if (ret.errno == DB_SUCCESS) {
+		// From now on, an interrupted migration is resumed by db_open().
+		db->map[offsetof(header_t, padding) + MIGRATION_MARKER] = 1;
+
+		const migration_state_t state = migration_plan(db, &info, fd);
+		ret = db_sync(db)
+			? migration_run(db, &state, 0, 0, 0)
+			: (db_return){ .errno = DB_MIGRATE_FAIL };
+	}
+
+	if (fd != -1)
+		close(fd);
+
+	// The summaries follow the new size of the bitmaps.
+	if (ret.errno == DB_SUCCESS) {
+		summary_free(&db->summaries[0]);
+		summary_free(&db->summaries[1]);
+
+		if (!summary_build(db, 0) || !summary_build(db, db->offset_bitmap))
+			ret.errno = DB_MIGRATE_FAIL;
+	}
 
-	// We write the flag.
-	return db_write_flag(db, position, db->offset_bitmap);
+	journal_release(db->journal);
+	pthread_rwlock_unlock(&db->lock);
+	return ret;
 }
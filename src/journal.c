@@ -0,0 +1,361 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shared.h"
+#include "journal.h"
+
+/*
+ * The journal is a sequence of records, each made of a header and, for the
+ * computed blocks, their digits as uint64_t. It is only read back by the
+ * machine that wrote it, so the integers are in the host byte order.
+ *
+ * Each process keeps a shared lock on the journal while it is open, so that
+ * the journal is only replayed by the last process. The others empty it
+ * once the database is synced without any write in progress.
+ */
+
+/** The suffix of the journal, after the database path. */
+#define JOURNAL_SUFFIX ".journal"
+
+#pragma pack(push, 1)
+/** The header of a journal record. */
+typedef struct {
+	/// The kind of the write.
+	uint64_t kind;
+
+	/// The position of the first block.
+	uint64_t first;
+
+	/// The number of blocks.
+	uint64_t count;
+
+	/// The checksum of the record, to detect a torn write.
+	uint64_t checksum;
+} record_t;
+#pragma pack(pop)
+
+/** A growable buffer of records. */
+typedef struct {
+	/// The records.
+	uint8_t *bytes;
+
+	/// The number of bytes used.
+	uint64_t used;
+
+	/// The number of bytes allocated.
+	uint64_t capacity;
+} buffer_t;
+
+struct journal_t {
+	/// The journal file descriptor.
+	int fd;
+
+	/// Protects everything below.
+	pthread_mutex_t lock;
+
+	/// Signaled when a group of records is synced.
+	pthread_cond_t synced;
+
+	/// The records waiting for the next group commit.
+	buffer_t pending;
+
+	/// The buffer of the previous group commit, to be reused.
+	buffer_t spare;
+
+	/// The number of records appended.
+	uint64_t appended;
+
+	/// The number of records synced.
+	uint64_t durable;
+
+	/// Whether a writer is syncing a group.
+	bool syncing;
+
+	/// Whether a group could not be synced.
+	bool failed;
+
+	/// The number of bytes written in the file.
+	uint64_t size;
+};
+
+/**
+ * @brief Computes the checksum of a record.
+ * @param record the header of the record, whose checksum is ignored
+ * @param digits the digits of the record, or NULL
+ * @return the checksum
+ */
+static uint64_t record_checksum(const record_t * const record, const uint64_t * const digits) {
+	uint64_t hash = fnv(FNV_BASIS, record, offsetof(record_t, checksum));
+
+	if (digits != NULL)
+		hash = fnv(hash, digits, BYTE * record->count);
+
+	return hash;
+}
+
+/**
+ * @brief Locks the journal against the other processes.
+ * @param j the journal
+ * @param command F_OFD_SETLK or F_OFD_SETLKW
+ * @param type F_RDLCK or F_WRLCK
+ * @return whether the lock is held
+ */
+static bool journal_lock(journal * const j, const int command, const short type) {
+	struct flock lock = {
+		.l_type = type,
+		.l_whence = SEEK_SET,
+		.l_start = 0,
+		.l_len = 1,
+	};
+
+	return fcntl(j->fd, command, &lock) != -1;
+}
+
+journal *journal_open(const char * const path) {
+	char file[strlen(path) + sizeof(JOURNAL_SUFFIX)];
+	strcpy(file, path);
+	strcat(file, JOURNAL_SUFFIX);
+
+	journal *j = (journal *)calloc(1, sizeof(journal));
+	if (j == NULL)
+		return NULL;
+
+	j->fd = open(file, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (j->fd == -1) {
+		free(j);
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(j->fd, &st) == -1 || !journal_lock(j, F_OFD_SETLKW, F_RDLCK)) {
+		close(j->fd);
+		free(j);
+		return NULL;
+	}
+
+	j->size = st.st_size;
+	pthread_mutex_init(&j->lock, NULL);
+	pthread_cond_init(&j->synced, NULL);
+
+	return j;
+}
+
+void journal_close(journal * const j) {
+	pthread_cond_destroy(&j->synced);
+	pthread_mutex_destroy(&j->lock);
+	free(j->pending.bytes);
+	free(j->spare.bytes);
+	close(j->fd);
+	free(j);
+}
+
+/**
+ * @brief Appends bytes to a buffer.
+ * @param buffer the buffer
+ * @param bytes the bytes to append
+ * @param length the number of bytes
+ * @return whether the buffer could grow
+ */
+static bool buffer_append(buffer_t * const buffer, const void * const bytes, const uint64_t length) {
+	if (buffer->used + length > buffer->capacity) {
+		uint64_t capacity = buffer->capacity == 0 ? BYTE * BYTE : buffer->capacity;
+		while (capacity < buffer->used + length)
+			capacity *= 2;
+
+		uint8_t *grown = (uint8_t *)realloc(buffer->bytes, capacity);
+		if (grown == NULL)
+			return false;
+
+		buffer->bytes = grown;
+		buffer->capacity = capacity;
+	}
+
+	memcpy(buffer->bytes + buffer->used, bytes, length);
+	buffer->used += length;
+
+	return true;
+}
+
+/**
+ * @brief Writes a whole buffer to the journal, and syncs it.
+ * @param j the journal
+ * @param buffer the buffer to write
+ * @return whether the buffer is durable
+ */
+static bool journal_flush(journal * const j, const buffer_t * const buffer) {
+	for (uint64_t done = 0; done < buffer->used;) {
+		const ssize_t written = write(j->fd, buffer->bytes + done, buffer->used - done);
+		if (written <= 0)
+			return false;
+
+		done += written;
+	}
+
+	return fdatasync(j->fd) == 0;
+}
+
+bool journal_commit(
+		journal * const j,
+		const journal_kind kind,
+		const uint64_t first,
+		const uint64_t count,
+		const uint64_t * const digits) {
+	record_t record = {
+		.kind = kind,
+		.first = first,
+		.count = count,
+	};
+	record.checksum = record_checksum(&record, digits);
+
+	pthread_mutex_lock(&j->lock);
+
+	// Once a group could not be synced, no record is durable anymore, so
+	// they are not even kept. A record whose digits do not fit is removed.
+	const uint64_t used = j->pending.used;
+	if (j->failed
+			|| !buffer_append(&j->pending, &record, sizeof(record))
+			|| (digits != NULL
+				&& !buffer_append(&j->pending, digits, BYTE * count))) {
+		j->pending.used = used;
+		pthread_mutex_unlock(&j->lock);
+		return false;
+	}
+
+	const uint64_t sequence = ++j->appended;
+
+	while (j->durable < sequence && !j->failed) {
+		if (j->syncing) {
+			pthread_cond_wait(&j->synced, &j->lock);
+			continue;
+		}
+
+		// This writer leads the group: it writes every pending record, its
+		// own included, with a single sync. The next group is buffered
+		// meanwhile.
+		const buffer_t group = j->pending;
+		const uint64_t last = j->appended;
+
+		j->pending = j->spare;
+		j->pending.used = 0;
+		j->syncing = true;
+
+		pthread_mutex_unlock(&j->lock);
+		const bool synced = journal_flush(j, &group);
+		pthread_mutex_lock(&j->lock);
+
+		j->spare = group;
+		j->size += group.used;
+		j->durable = last;
+		j->failed |= !synced;
+		j->syncing = false;
+
+		// The writers of the next group fail with this one.
+		if (j->failed)
+			j->pending.used = 0;
+
+		pthread_cond_broadcast(&j->synced);
+	}
+
+	const bool durable = !j->failed;
+	pthread_mutex_unlock(&j->lock);
+
+	return durable;
+}
+
+bool journal_replay(journal * const j, const journal_apply apply, void * const context) {
+	uint64_t *digits = NULL;
+	uint64_t capacity = 0;
+	bool applied = true;
+
+	for (uint64_t offset = 0; applied;) {
+		record_t record;
+		if (pread(j->fd, &record, sizeof(record), offset) != sizeof(record))
+			break;
+
+		if (record.kind != JOURNAL_COMPUTED && record.kind != JOURNAL_CHECKED)
+			break;
+
+		// A torn count cannot make us allocate the whole memory.
+		const bool computed = record.kind == JOURNAL_COMPUTED;
+		if (computed && record.count > j->size / BYTE)
+			break;
+
+		const uint64_t length = computed ? BYTE * record.count : 0;
+		if (offset + sizeof(record) + length > j->size)
+			break;
+
+		if (length > capacity) {
+			uint64_t *grown = (uint64_t *)realloc(digits, length);
+			if (grown == NULL) {
+				applied = false;
+				break;
+			}
+
+			digits = grown;
+			capacity = length;
+		}
+
+		if (computed
+				&& pread(j->fd, digits, length, offset + sizeof(record)) != (ssize_t)length)
+			break;
+
+		if (record.checksum != record_checksum(&record, computed ? digits : NULL))
+			break;
+
+		applied = apply(context, record.kind, record.first, record.count,
+			computed ? digits : NULL);
+		offset += sizeof(record) + length;
+	}
+
+	free(digits);
+	return applied;
+}
+
+uint64_t journal_size(journal * const j) {
+	// The other processes append to the same file.
+	struct stat st;
+	if (fstat(j->fd, &st) == 0)
+		return st.st_size;
+
+	pthread_mutex_lock(&j->lock);
+	const uint64_t size = j->size;
+	pthread_mutex_unlock(&j->lock);
+
+	return size;
+}
+
+bool journal_acquire(journal * const j) {
+	return journal_lock(j, F_OFD_SETLK, F_WRLCK);
+}
+
+void journal_release(journal * const j) {
+	journal_lock(j, F_OFD_SETLKW, F_RDLCK);
+}
+
+bool journal_truncate(journal * const j) {
+	if (ftruncate(j->fd, 0) != 0)
+		return false;
+
+	j->size = 0;
+	return true;
+}
+
+bool journal_checkpoint(journal * const j, bool (*sync)(void *), void * const context) {
+	// Another process may still apply the records it journaled.
+	if (!journal_acquire(j))
+		return false;
+
+	const bool emptied = sync(context) && journal_truncate(j);
+
+	journal_release(j);
+	return emptied;
+}
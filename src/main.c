@@ -1,3 +1,4 @@
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -5,11 +6,23 @@
 
 #include "shared.h"
 #include "algorithm.h"
+#include "bulk.h"
 #include "converter.h"
 #include "database.h"
+#include "search.h"
+#include "stats.h"
 
 #define N 10
 
+/** The number of first blocks computed at once by binary splitting. */
+#define PREFIX 4
+
+/** The number of consecutive blocks computed by a thread at once. */
+#define RANGE 3
+
+/** The number of bytes of memory for the conversion to base 10. */
+#define CONVERT_BUDGET (1 << 20)
+
 int main(void) {
 	printf("Mapping values to enum:\n");
 	printf("# SUCCESS\t%d\n", DB_SUCCESS);
@@ -24,6 +37,13 @@ int main(void) {
 	printf("# WRITE_CHECK_NOT_COMPUTED\t%d\n", DB_WRITE_CHECK_NOT_COMPUTED);
 	printf("# WRITE_ALREADY_CHECKED\t%d\n", DB_WRITE_ALREADY_CHECKED);
 	printf("# WRITE_OUT_OF_BOUNDS\t%d\n", DB_WRITE_OUT_OF_BOUNDS);
+	printf("# LOCK_FAIL\t%d\n", DB_LOCK_FAIL);
+	printf("# JOURNAL_FAIL\t%d\n", DB_JOURNAL_FAIL);
+	printf("# LEASE_FAIL\t%d\n", DB_LEASE_FAIL);
+	printf("# READ_CORRUPTED\t%d\n", DB_READ_CORRUPTED);
+	printf("# READ_NOT_FOUND\t%d\n", DB_READ_NOT_FOUND);
+	printf("# WRITE_FAIL\t%d\n", DB_WRITE_FAIL);
+	printf("# READ_INVALID\t%d\n", DB_READ_INVALID);
 
 	printf("> Create database\n");
 	db_return create = db_create("./database.pidb", 1000);
@@ -43,17 +63,80 @@ int main(void) {
 
 	uint64_t digits[N] = { 0 };
 
+	// The prefix is computed at once by binary splitting. Then each thread
+	// extends it with a range of consecutive blocks, which is cheaper than
+	// the same blocks one by one, and commits it right away.
+	pi_prefix(PREFIX, digits);
+
+	db_return prefix = db_write_range(db, 0, PREFIX, digits);
+	if (prefix.errno != DB_SUCCESS)
+		printf("> Error: (0) %d\n", prefix.errno);
+
+#pragma omp parallel for schedule(dynamic)
+	for (uint64_t i = PREFIX; i < N; i += RANGE) {
+		const uint64_t count = N - i < RANGE ? N - i : RANGE;
+		pi_range(i, count, digits + i);
+
+		db_return write = db_write_range(db, i, count, digits + i);
+		if (write.errno != DB_SUCCESS)
+			printf("> Error: (%ld) %d\n", i, write.errno);
+	}
+
+	// The blocks are checked with windows shifted by half a block: the window
+	// between blocks i and i + 1 confirms the end of the first one and the
+	// start of the second one at once, without repeating their computation.
+	// The first block has no window before it, so its start is checked by
+	// recomputing it with the other formula.
+	window_check windows[N];
+
 #pragma omp parallel for schedule(dynamic)
 	for (uint64_t i = 0; i < N; ++i)
-		digits[i] = pi(i);
+		windows[i] = pi_check(i, digits[i], i + 1 < N ? digits[i + 1] : 0);
+
+	const bool first = pi_engine(0, ENGINE_BELLARD) == digits[0];
 
 	for (uint64_t i = 0; i < N; ++i) {
-		db_return write = db_write_computed(db, BLOCK_SIZE * i, digits[i]);
+		const bool start = i == 0 ? first : windows[i - 1].next;
 
-		if (write.errno != DB_SUCCESS)
-			printf("> Error: (%ld) %d\n", i, write.errno);
+		if (!start || !windows[i].block) {
+			printf("> Mismatch: (%ld) %lx\n", i, digits[i]);
+			continue;
+		}
+
+		db_return check = db_write_checked(db, i);
+
+		if (check.errno != DB_SUCCESS)
+			printf("> Error: (%ld) %d\n", i, check.errno);
 	}
 
+	search *index;
+	if (search_open(db, "./database.pidx", &index).errno == DB_SUCCESS) {
+		db_return found = search_find(index, "a308d3");
+		if (found.errno == DB_SUCCESS)
+			printf("> Found a308d3 at %lu\n", found.value.position);
+
+		search_close(index);
+	}
+
+	stats *statistics;
+	if (stats_open(db, "./database.pist", &statistics).errno == DB_SUCCESS) {
+		stats_digits digits_stats;
+		if (stats_read(statistics, 0, N, &digits_stats).errno == DB_SUCCESS)
+			printf("> Chi-square %.2f, longest run %lu\n",
+				digits_stats.chi_square,
+				digits_stats.longest.length);
+
+		stats_close(statistics);
+	}
+
+	db_return decimals = convert_database(db, N, "./database.txt", CONVERT_BUDGET);
+	if (decimals.errno != DB_SUCCESS)
+		printf("> Error: (convert) %d\n", decimals.errno);
+
+	printf("> Computed %lu, checked %lu\n",
+		db_read_computed_count(db).value.count,
+		db_read_checked_count(db).value.count);
+
 	printf("> Close\n");
 	db_close(db);
 	return 0;
@@ -0,0 +1,72 @@
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "shared.h"
+#include "nibble.h"
+
+/** The number of vectors counted before the 8-bit counters overflow. */
+#define ROUNDS 255
+
+void nibble_unpack(const uint64_t * const blocks, const uint64_t count, uint8_t * const digits) {
+	uint64_t k = 0;
+
+#if defined(__SSE2__)
+	// Two blocks make 16 bytes, whose upper and lower digits are split and
+	// then interleaved back in order.
+	const __m128i mask = _mm_set1_epi8(0x0F);
+
+	for (; count - k >= 2; k += 2) {
+		const uint64_t bytes[2] = {
+			__builtin_bswap64(blocks[k]),
+			__builtin_bswap64(blocks[k + 1]),
+		};
+		const __m128i packed = _mm_loadu_si128((const __m128i *)bytes);
+		const __m128i upper = _mm_and_si128(_mm_srli_epi16(packed, NIBBLE), mask);
+		const __m128i lower = _mm_and_si128(packed, mask);
+
+		_mm_storeu_si128((__m128i *)(digits + BLOCK_SIZE * k), _mm_unpacklo_epi8(upper, lower));
+		_mm_storeu_si128((__m128i *)(digits + BLOCK_SIZE * (k + 1)), _mm_unpackhi_epi8(upper, lower));
+	}
+#endif
+
+	for (; k < count; ++k)
+		for (uint8_t d = 0; d < BLOCK_SIZE; ++d)
+			digits[BLOCK_SIZE * k + d] = (blocks[k] >> (NIBBLE * (BLOCK_SIZE - 1 - d))) & 0xF;
+}
+
+void nibble_count(const uint8_t * const digits, const uint64_t length, uint64_t counts[RADIX]) {
+	uint64_t k = 0;
+
+#if defined(__SSE2__)
+	// Each digit has 16 8-bit counters, decreased by the comparisons (which
+	// give -1), and summed before they overflow.
+	const __m128i zero = _mm_setzero_si128();
+
+	while (length - k >= BLOCK_SIZE) {
+		__m128i counters[RADIX];
+		for (uint8_t d = 0; d < RADIX; ++d)
+			counters[d] = zero;
+
+		const uint64_t rounds = (length - k) / BLOCK_SIZE < ROUNDS ? (length - k) / BLOCK_SIZE : ROUNDS;
+
+		for (uint64_t r = 0; r < rounds; ++r, k += BLOCK_SIZE) {
+			const __m128i values = _mm_loadu_si128((const __m128i *)(digits + k));
+
+			for (uint8_t d = 0; d < RADIX; ++d)
+				counters[d] = _mm_sub_epi8(counters[d], _mm_cmpeq_epi8(values, _mm_set1_epi8(d)));
+		}
+
+		for (uint8_t d = 0; d < RADIX; ++d) {
+			const __m128i sums = _mm_sad_epu8(counters[d], zero);
+			counts[d] += (uint64_t)_mm_cvtsi128_si32(sums)
+				+ (uint64_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+		}
+	}
+#endif
+
+	for (; k < length; ++k)
+		++counts[digits[k]];
+}
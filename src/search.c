@@ -0,0 +1,1038 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "shared.h"
+#include "database.h"
+#include "nibble.h"
+#include "search.h"
+
+/*
+ * The index is a 64-byte header, followed by the first position of every
+ * string of 1 to GRAMS digits, plus one so that 0 means it never appeared,
+ * and by a bitmap of the blocks already indexed.
+ *
+ * A string of at most GRAMS digits is found with a single lookup. A longer
+ * string cannot appear before the first position of any of its substrings
+ * of GRAMS digits, minus the offset of this substring inside it.
+ *
+ * The lists, in a file next to the index, hold the string of GRAMS digits
+ * starting at every STEP-th position, with the position: each entry is the
+ * string in its upper bits and the position divided by STEP in its lower
+ * POSITION_BITS bits. They are runs sorted by string, the positions of a
+ * string being in no particular order, the largest run first, and a new run
+ * is merged with the one before as long as that one is not more than twice
+ * as large, so that there are few runs and each entry is moved few times.
+ *
+ * Every occurrence of a string of GRAMS + STEP - 1 digits or more holds a
+ * listed substring, at an offset fixed by its position modulo STEP. For each
+ * of these STEP cases, the rarest of the substrings at the right offsets
+ * gives the candidates, and each of them is compared with the digits.
+ *
+ * The positions only decrease, and each of them is a real occurrence, so
+ * the searches read them without any lock. The runs are moved by the
+ * updates, so their readers and the updates exclude each other. The updates
+ * are serialized. An update marks the header first, and unmarks it once the
+ * positions and the lists reached the disk: an index found marked was
+ * interrupted, its bitmap may be ahead of its positions and lists, so the
+ * lists are emptied and every block is indexed again.
+ */
+
+/** The index magic number. */
+#define SEARCH_MAGIC "PiIX\x24\x3F\x6A\x88"
+
+/** The index version. */
+#define SEARCH_VERSION 1
+
+/** The length of the longest strings whose first position is kept. */
+#define GRAMS 6
+
+/** The number of positions, for the strings of every length. */
+#define ENTRIES ((((uint64_t)1 << (NIBBLE * (GRAMS + 1))) - RADIX) / (RADIX - 1))
+
+/** The number of blocks read at once. */
+#define SEARCH_BLOCKS 4096
+
+/** The number of bits of a word of the bitmap. */
+#define WORD 64
+
+/** The suffix of the path of the lists. */
+#define LISTS_SUFFIX ".lists"
+
+/** The lists magic number. */
+#define LISTS_MAGIC "PiIL\x24\x3F\x6A\x88"
+
+/** The lists version. */
+#define LISTS_VERSION 1
+
+/**
+ * The distance between two positions whose string is listed, at most 2 so
+ * that the lists hold a substring of every string longer than GRAMS.
+ */
+#define STEP 2
+
+/** The number of bits of the position of an entry, divided by STEP. */
+#define POSITION_BITS 40
+
+/** The mask of the position of an entry. */
+#define POSITION_MASK (((uint64_t)1 << POSITION_BITS) - 1)
+
+/** The largest number of runs. */
+#define RUNS 62
+
+/** The number of entries gathered before they are sorted into a run. */
+#define RUN_ENTRIES ((uint64_t)1 << 22)
+
+/** The number of bits of the string of an entry sorted at once. */
+#define SORT_BITS 12
+
+/** The number of substrings compared to find the rarest one, per case. */
+#define CHOICES 64
+
+#pragma pack(push, 1)
+/** The index header. */
+typedef struct {
+	/// Index magic number.
+	uint8_t magic_number[8];
+
+	/// Index version.
+	uint8_t version;
+
+	/// Length of the longest strings whose first position is kept.
+	uint8_t grams;
+
+	/// Whether an update may have been interrupted.
+	uint8_t updating;
+
+	/// Padding (reserved for future use).
+	uint8_t padding[37];
+
+	/// Number of blocks of the bitmap.
+	uint64_t blocks;
+
+	/// Number of blocks indexed.
+	uint64_t indexed;
+} index_t;
+
+/** The lists header. */
+typedef struct {
+	/// Lists magic number.
+	uint8_t magic_number[8];
+
+	/// Lists version.
+	uint8_t version;
+
+	/// Number of runs.
+	uint8_t count;
+
+	/// Padding (reserved for future use).
+	uint8_t padding[6];
+
+	/// Number of entries of each run, in the order they are stored.
+	uint64_t runs[RUNS];
+} lists_t;
+#pragma pack(pop)
+
+struct search_t {
+	/// The indexed database.
+	database *db;
+
+	/// The file descriptor of the index.
+	int fd;
+
+	/// The mapping of the index.
+	uint8_t *map;
+
+	/// The length of the mapping.
+	uint64_t length;
+
+	/// The first positions, plus one, of the strings of every length.
+	uint64_t *first;
+
+	/// The bitmap of the blocks indexed.
+	uint64_t *indexed;
+
+	/// Serializes the updates between the threads.
+	pthread_mutex_t updating;
+
+	/// The file descriptor of the lists.
+	int lists_fd;
+
+	/// The mapping of the lists.
+	uint8_t *lists;
+
+	/// The length of the mapping of the lists.
+	uint64_t lists_length;
+
+	/// Serializes the threads using the lists, which share their file lock.
+	pthread_mutex_t listing;
+
+	/// The entries of the blocks indexed, not in a run yet, followed by as
+	/// many to sort them.
+	uint64_t *pending;
+
+	/// The number of pending entries.
+	uint64_t used;
+};
+
+/**
+ * @brief Locks the index against the other processes.
+ * @param index the index
+ * @param type F_WRLCK or F_UNLCK
+ * @return whether the lock is held
+ */
+static bool search_lock(const search * const index, const short type) {
+	struct flock lock = {
+		.l_type = type,
+		.l_whence = SEEK_SET,
+		.l_start = 0,
+		.l_len = 0,
+	};
+
+	return fcntl(index->fd, F_OFD_SETLKW, &lock) != -1;
+}
+
+/**
+ * @brief Gets the header of an index.
+ * @param index the index
+ * @return the header, inside the mapping
+ */
+static inline index_t *search_header(const search * const index) {
+	return (index_t *)index->map;
+}
+
+/**
+ * @brief Gets the first position of a string.
+ * @param index the index
+ * @param length the number of digits of the string, at most GRAMS
+ * @param gram the digits of the string, the first one in the upper bits
+ * @return the first position plus one, inside the mapping
+ */
+static inline uint64_t *search_entry(const search * const index, const uint64_t length, const uint64_t gram) {
+	// The strings of length k come after the 16 + ... + 16^(k - 1) shorter
+	// ones.
+	const uint64_t before = (((uint64_t)1 << (NIBBLE * length)) - RADIX) / (RADIX - 1);
+	return &index->first[before + gram];
+}
+
+/**
+ * @brief Locks the lists against the other processes.
+ * @param index the index
+ * @param type F_RDLCK, F_WRLCK or F_UNLCK
+ * @return whether the lock is held
+ */
+static bool lists_lock(const search * const index, const short type) {
+	struct flock lock = {
+		.l_type = type,
+		.l_whence = SEEK_SET,
+		.l_start = 0,
+		.l_len = 0,
+	};
+
+	return fcntl(index->lists_fd, F_OFD_SETLKW, &lock) != -1;
+}
+
+/**
+ * @brief Gets the header of the lists.
+ * @param index the index
+ * @return the header, inside the mapping
+ */
+static inline lists_t *lists_header(const search * const index) {
+	return (lists_t *)index->lists;
+}
+
+/**
+ * @brief Gets the entries of the lists.
+ * @param index the index
+ * @return the entries of every run, inside the mapping
+ */
+static inline uint64_t *lists_entries(const search * const index) {
+	return (uint64_t *)(index->lists + sizeof(lists_t));
+}
+
+/**
+ * @brief Counts the entries of the lists.
+ * @param header the header of the lists
+ * @return the number of entries of every run
+ */
+static uint64_t lists_total(const lists_t * const header) {
+	uint64_t total = 0;
+	for (uint64_t r = 0; r < header->count; ++r)
+		total += header->runs[r];
+
+	return total;
+}
+
+/**
+ * @brief Maps enough of the lists.
+ * @param index the index, with the lists locked
+ * @param entries the number of entries to map
+ * @param grow whether the file may grow to hold them
+ * @return only if the entries are mapped
+ *
+ * The file never shrinks, so that the mappings of the other processes stay
+ * valid.
+ */
+static bool lists_map(search * const index, const uint64_t entries, const bool grow) {
+	const uint64_t length = sizeof(lists_t) + sizeof(uint64_t) * entries;
+	if (length <= index->lists_length)
+		return true;
+
+	struct stat st;
+	if (fstat(index->lists_fd, &st) != 0)
+		return false;
+
+	uint64_t size = st.st_size;
+	if (size < length) {
+		if (!grow || ftruncate(index->lists_fd, length) != 0)
+			return false;
+
+		size = length;
+	}
+
+	uint8_t *map = (uint8_t *)mremap(index->lists, index->lists_length, size, MREMAP_MAYMOVE);
+	if (map == MAP_FAILED)
+		return false;
+
+	index->lists = map;
+	index->lists_length = size;
+	return true;
+}
+
+/**
+ * @brief Finds a bound inside a run.
+ * @param run the entries of the run
+ * @param count the number of entries
+ * @param key the entry to look for
+ * @param strict whether the entries equal to key are before the bound
+ * @return the number of entries before key, or up to key if strict
+ */
+static uint64_t lists_bound(const uint64_t * const run, const uint64_t count, const uint64_t key, const bool strict) {
+	uint64_t low = 0, high = count;
+	while (low < high) {
+		const uint64_t middle = low + (high - low) / 2;
+		if (run[middle] < key || (strict && run[middle] == key))
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+/**
+ * @brief Counts the occurrences of a string in the lists.
+ * @param index the index, with the lists locked and mapped
+ * @param gram the digits of the string of GRAMS digits
+ * @return the number of its entries
+ */
+static uint64_t lists_count(const search * const index, const uint64_t gram) {
+	const lists_t * const header = lists_header(index);
+	const uint64_t *run = lists_entries(index);
+	uint64_t count = 0;
+
+	for (uint64_t r = 0; r < header->count; run += header->runs[r++])
+		count += lists_bound(run, header->runs[r], (gram << POSITION_BITS) | POSITION_MASK, true)
+			- lists_bound(run, header->runs[r], gram << POSITION_BITS, false);
+
+	return count;
+}
+
+/**
+ * @brief Sorts entries by string.
+ * @param entries the entries
+ * @param count the number of entries
+ * @param scratch a buffer of count entries
+ *
+ * Each pass is stable and sorts SORT_BITS bits of the strings, the lowest
+ * first.
+ */
+static void lists_sort(uint64_t *entries, const uint64_t count, uint64_t *scratch) {
+	uint64_t * const sorted = entries;
+
+	for (uint64_t shift = POSITION_BITS; shift < POSITION_BITS + NIBBLE * GRAMS; shift += SORT_BITS) {
+		uint64_t counts[1 << SORT_BITS] = { 0 };
+		for (uint64_t k = 0; k < count; ++k)
+			++counts[(entries[k] >> shift) & ((1 << SORT_BITS) - 1)];
+
+		for (uint64_t b = 0, total = 0; b < (1 << SORT_BITS); ++b) {
+			const uint64_t size = counts[b];
+			counts[b] = total;
+			total += size;
+		}
+
+		for (uint64_t k = 0; k < count; ++k)
+			scratch[counts[(entries[k] >> shift) & ((1 << SORT_BITS) - 1)]++] = entries[k];
+
+		uint64_t * const swap = entries;
+		entries = scratch;
+		scratch = swap;
+	}
+
+	if (entries != sorted)
+		memcpy(sorted, entries, sizeof(uint64_t) * count);
+}
+
+/**
+ * @brief Merges the last two runs.
+ * @param index the index, with the lists locked
+ * @return only if they could be merged
+ *
+ * The last run is copied past the end, and both are merged from their
+ * end, so that the merged run takes their place.
+ */
+static bool lists_merge(search * const index) {
+	const uint64_t total = lists_total(lists_header(index));
+	if (!lists_map(index, total + lists_header(index)->runs[lists_header(index)->count - 1], true))
+		return false;
+
+	lists_t * const header = lists_header(index);
+	uint64_t * const entries = lists_entries(index);
+	const uint64_t last = header->runs[header->count - 1];
+	const uint64_t start = total - last - header->runs[header->count - 2];
+
+	memcpy(entries + total, entries + total - last, sizeof(uint64_t) * last);
+
+	uint64_t before = total - last, after = last, k = total;
+	while (after > 0)
+		entries[--k] = before > start && entries[before - 1] > entries[total + after - 1]
+			? entries[--before]
+			: entries[total + --after];
+
+	header->runs[header->count - 2] += last;
+	--header->count;
+	return true;
+}
+
+/**
+ * @brief Stores the pending entries as a new run.
+ * @param index the index, locked
+ * @return only if the run could be stored
+ */
+static bool lists_push(search * const index) {
+	if (index->used == 0)
+		return true;
+
+	lists_sort(index->pending, index->used, index->pending + RUN_ENTRIES);
+
+	pthread_mutex_lock(&index->listing);
+	if (!lists_lock(index, F_WRLCK)) {
+		pthread_mutex_unlock(&index->listing);
+		return false;
+	}
+
+	const uint64_t total = lists_total(lists_header(index));
+	bool stored = lists_map(index, total + index->used, true);
+
+	if (stored) {
+		lists_t *header = lists_header(index);
+		memcpy(lists_entries(index) + total, index->pending, sizeof(uint64_t) * index->used);
+		header->runs[header->count++] = index->used;
+		index->used = 0;
+
+		// The runs stay fewer than RUNS, since each one is more than twice as
+		// large as the next. A merge may move the mapping.
+		while (stored && header->count > 1
+				&& (header->runs[header->count - 2] <= 2 * header->runs[header->count - 1]
+					|| header->count == RUNS)) {
+			stored = lists_merge(index);
+			header = lists_header(index);
+		}
+	}
+
+	lists_lock(index, F_UNLCK);
+	pthread_mutex_unlock(&index->listing);
+	return stored;
+}
+
+/**
+ * @brief Opens the lists of an index, creating them if needed.
+ * @param index the index, locked
+ * @param path the path of the index
+ * @param fresh set if the lists were not valid, so that they miss the blocks
+ * already indexed
+ * @return only if the operation succeeded
+ */
+static db_error lists_open(search * const index, const char * const path, bool * const fresh) {
+	char file[strlen(path) + sizeof(LISTS_SUFFIX)];
+	strcpy(file, path);
+	strcat(file, LISTS_SUFFIX);
+
+	index->lists_fd = open(file, O_RDWR | O_CREAT, 0644);
+	if (index->lists_fd == -1)
+		return DB_OPEN_FAIL;
+
+	if (!lists_lock(index, F_WRLCK)) {
+		close(index->lists_fd);
+		return DB_LOCK_FAIL;
+	}
+
+	lists_t header = { 0 };
+	struct stat st;
+	bool valid = fstat(index->lists_fd, &st) == 0;
+	const bool opened = valid;
+
+	valid = valid
+		&& (uint64_t)st.st_size >= sizeof(lists_t)
+		&& pread(index->lists_fd, &header, sizeof(header), 0) == sizeof(header)
+		&& memcmp(header.magic_number, LISTS_MAGIC, 8) == 0
+		&& header.version == LISTS_VERSION
+		&& header.count < RUNS
+		&& sizeof(lists_t) + sizeof(uint64_t) * lists_total(&header) <= (uint64_t)st.st_size;
+
+	// Lists that are new, or not valid, start empty.
+	*fresh = !valid;
+	if (opened && !valid) {
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic_number, LISTS_MAGIC, 8);
+		header.version = LISTS_VERSION;
+		valid = pwrite(index->lists_fd, &header, sizeof(header), 0) == sizeof(header);
+		st.st_size = st.st_size > (off_t)sizeof(lists_t) ? st.st_size : (off_t)sizeof(lists_t);
+	}
+
+	index->lists = MAP_FAILED;
+	if (valid) {
+		index->lists_length = st.st_size;
+		index->lists = (uint8_t *)mmap(NULL, index->lists_length, PROT_READ | PROT_WRITE, MAP_SHARED, index->lists_fd, 0);
+	}
+
+	lists_lock(index, F_UNLCK);
+	if (index->lists == MAP_FAILED) {
+		close(index->lists_fd);
+		return DB_OPEN_FAIL;
+	}
+
+	pthread_mutex_init(&index->listing, NULL);
+	index->pending = NULL;
+	index->used = 0;
+	return DB_SUCCESS;
+}
+
+db_return search_open(database * const db, const char * const path, search ** const index) {
+	const db_return capacity = db_read_capacity(db);
+	if (capacity.errno != DB_SUCCESS)
+		return capacity;
+
+	// The lists cannot hold the positions past their limit.
+	if (capacity.value.count > (STEP * POSITION_MASK) / BLOCK_SIZE)
+		return (db_return){ .errno = DB_OPEN_FAIL };
+
+	search *s = (search *)malloc(sizeof(search));
+	if (s == NULL)
+		return (db_return){ .errno = DB_OPEN_FAIL };
+
+	s->db = db;
+	s->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (s->fd == -1) {
+		free(s);
+		return (db_return){ .errno = DB_OPEN_FAIL };
+	}
+
+	if (!search_lock(s, F_WRLCK)) {
+		close(s->fd);
+		free(s);
+		return (db_return){ .errno = DB_LOCK_FAIL };
+	}
+
+	// A new index is filled with zeros, so that no string appeared yet and
+	// no block is indexed. The bitmap grows with the database.
+	index_t header = { 0 };
+	struct stat st;
+	bool valid = fstat(s->fd, &st) == 0;
+	const bool created = valid && st.st_size == 0;
+
+	if (valid && !created)
+		valid = pread(s->fd, &header, sizeof(header), 0) == sizeof(header);
+
+	db_error error = valid ? DB_SUCCESS : DB_OPEN_FAIL;
+	if (valid && !created
+			&& (memcmp(header.magic_number, SEARCH_MAGIC, 8) != 0
+				|| header.version != SEARCH_VERSION
+				|| header.grams != GRAMS))
+		error = DB_OPEN_WRONG_FORMAT;
+
+	const uint64_t blocks = header.blocks > capacity.value.count
+		? header.blocks
+		: capacity.value.count;
+	s->length = sizeof(index_t)
+		+ sizeof(uint64_t) * ENTRIES
+		+ sizeof(uint64_t) * CEIL_DIV(blocks, WORD);
+
+	if (error == DB_SUCCESS && (uint64_t)st.st_size < s->length && ftruncate(s->fd, s->length) != 0)
+		error = DB_OPEN_FAIL;
+
+	s->map = MAP_FAILED;
+	if (error == DB_SUCCESS)
+		s->map = (uint8_t *)mmap(NULL, s->length, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+
+	if (error == DB_SUCCESS && s->map == MAP_FAILED)
+		error = DB_OPEN_FAIL;
+
+	bool fresh = false;
+	if (error == DB_SUCCESS)
+		error = lists_open(s, path, &fresh);
+
+	if (error != DB_SUCCESS) {
+		if (s->map != MAP_FAILED)
+			munmap(s->map, s->length);
+
+		search_lock(s, F_UNLCK);
+		close(s->fd);
+		free(s);
+		return (db_return){ .errno = error };
+	}
+
+	if (created) {
+		memcpy(header.magic_number, SEARCH_MAGIC, 8);
+		header.version = SEARCH_VERSION;
+		header.grams = GRAMS;
+	}
+
+	// The blocks indexed without the lists are indexed again, as after an
+	// interrupted update.
+	if (fresh && !created)
+		header.updating = 1;
+
+	header.blocks = blocks;
+	memcpy(s->map, &header, sizeof(header));
+	search_lock(s, F_UNLCK);
+
+	s->first = (uint64_t *)(s->map + sizeof(index_t));
+	s->indexed = s->first + ENTRIES;
+	pthread_mutex_init(&s->updating, NULL);
+
+	*index = s;
+	return (db_return){ .errno = DB_SUCCESS };
+}
+
+void search_close(search * const index) {
+	munmap(index->map, index->length);
+	close(index->fd);
+	pthread_mutex_destroy(&index->updating);
+	munmap(index->lists, index->lists_length);
+	close(index->lists_fd);
+	pthread_mutex_destroy(&index->listing);
+	free(index);
+}
+
+/**
+ * @brief Finds the first block of a bitmap with a given flag.
+ * @param bitmap the bitmap
+ * @param from the first block to test
+ * @param end the block after the last one to test
+ * @param set the flag to look for
+ * @return the first block with its flag equal to set, or end
+ */
+static uint64_t search_next(const uint64_t * const bitmap, const uint64_t from, const uint64_t end, const bool set) {
+	for (uint64_t k = from; k < end;) {
+		uint64_t word = bitmap[k / WORD] ^ (set ? 0 : ~(uint64_t)0);
+		word &= ~(uint64_t)0 << (k % WORD);
+
+		if (word != 0) {
+			const uint64_t found = k - k % WORD + __builtin_ctzll(word);
+			return found < end ? found : end;
+		}
+
+		k += WORD - k % WORD;
+	}
+
+	return end;
+}
+
+/**
+ * @brief Indexes consecutive blocks.
+ * @param index the index, locked
+ * @param first the first block to index
+ * @param end the block after the last one to index
+ * @param run the first and last computed blocks around them
+ * @param blocks a buffer of SEARCH_BLOCKS + 2 blocks
+ * @param digits a buffer of their digits
+ * @return only if the blocks could be read
+ *
+ * The strings starting in the blocks are recorded, as well as the ones that
+ * start in the block before and end in the blocks. The entries of the lists
+ * are pending until RUN_ENTRIES of them are gathered.
+ */
+static db_return search_index(
+		search * const index,
+		const uint64_t first,
+		const uint64_t end,
+		const uint64_t run[2],
+		uint64_t * const blocks,
+		uint8_t * const digits) {
+	const uint64_t low = first > run[0] ? first - 1 : first;
+	const uint64_t high = end < run[1] ? end + 1 : end;
+
+	db_return ret = db_read_range(index->db, low, high - low, blocks);
+	if (ret.errno != DB_SUCCESS)
+		return ret;
+
+	nibble_unpack(blocks, high - low, digits);
+
+	const uint64_t length = BLOCK_SIZE * (high - low);
+	const uint64_t start = first > low ? BLOCK_SIZE - (GRAMS - 1) : 0;
+	const uint64_t stop = BLOCK_SIZE * (end - low);
+
+	for (uint64_t p = start; p < stop; ++p) {
+		const uint64_t position = BLOCK_SIZE * low + p;
+		uint64_t gram = 0;
+
+		for (uint64_t k = 1; k <= GRAMS && p + k <= length; ++k) {
+			gram = (gram << NIBBLE) | digits[p + k - 1];
+
+			uint64_t * const entry = search_entry(index, k, gram);
+			const uint64_t seen = __atomic_load_n(entry, __ATOMIC_RELAXED);
+			if (seen == 0 || seen > position + 1)
+				__atomic_store_n(entry, position + 1, __ATOMIC_RELAXED);
+		}
+
+		if (p + GRAMS > length || position % STEP != 0)
+			continue;
+
+		index->pending[index->used++] = (gram << POSITION_BITS) | (position / STEP);
+		if (index->used == RUN_ENTRIES && !lists_push(index))
+			return (db_return){ .errno = DB_WRITE_FAIL };
+	}
+
+	for (uint64_t k = first; k < end; ++k)
+		index->indexed[k / WORD] |= (uint64_t)1 << (k % WORD);
+
+	return (db_return){ .errno = DB_SUCCESS };
+}
+
+/**
+ * @brief Indexes every computed block not indexed yet.
+ * @param index the index, locked
+ * @return the number of blocks newly indexed
+ */
+static db_return search_catch_up(search * const index) {
+	index_t * const header = search_header(index);
+
+	uint64_t *blocks = (uint64_t *)malloc(sizeof(uint64_t) * (SEARCH_BLOCKS + 2));
+	uint8_t *digits = (uint8_t *)malloc(BLOCK_SIZE * (SEARCH_BLOCKS + 2));
+	index->pending = (uint64_t *)malloc(sizeof(uint64_t) * 2 * RUN_ENTRIES);
+	index->used = 0;
+	if (blocks == NULL || digits == NULL || index->pending == NULL) {
+		free(blocks);
+		free(digits);
+		free(index->pending);
+		index->pending = NULL;
+		return (db_return){ .errno = DB_READ_NOT_READY };
+	}
+
+	db_return ret = { .errno = DB_SUCCESS };
+	uint64_t count = 0;
+
+	for (uint64_t start = 0; ret.errno == DB_SUCCESS && start < header->blocks;) {
+		const db_return found = db_read_computed_run(index->db, start);
+		if (found.errno != DB_SUCCESS)
+			break;
+
+		const uint64_t run[2] = {
+			found.value.range.position,
+			found.value.range.position + found.value.range.count,
+		};
+
+		// The blocks not indexed yet are indexed by slices, with their
+		// neighbours inside the run.
+		uint64_t k = search_next(index->indexed, run[0], run[1], false);
+		while (ret.errno == DB_SUCCESS && k < run[1]) {
+			const uint64_t limit = run[1] - k < SEARCH_BLOCKS ? run[1] : k + SEARCH_BLOCKS;
+			const uint64_t end = search_next(index->indexed, k, limit, true);
+
+			ret = search_index(index, k, end, run, blocks, digits);
+			count += end - k;
+			k = search_next(index->indexed, end, run[1], false);
+		}
+
+		start = run[1];
+	}
+
+	if (ret.errno == DB_SUCCESS && !lists_push(index))
+		ret = (db_return){ .errno = DB_WRITE_FAIL };
+
+	free(blocks);
+	free(digits);
+	free(index->pending);
+	index->pending = NULL;
+
+	if (ret.errno != DB_SUCCESS)
+		return ret;
+
+	return (db_return){
+		.errno = DB_SUCCESS,
+		.value = { .count = count },
+	};
+}
+
+db_return search_update(search * const index) {
+	index_t * const header = search_header(index);
+	const uint64_t computed = db_read_computed_count(index->db).value.count;
+
+	// The indexed blocks are computed, so there is nothing new when there
+	// are as many of them.
+	if (!__atomic_load_n(&header->updating, __ATOMIC_ACQUIRE)
+			&& __atomic_load_n(&header->indexed, __ATOMIC_ACQUIRE) == computed)
+		return (db_return){ .errno = DB_SUCCESS, .value = { .count = 0 } };
+
+	pthread_mutex_lock(&index->updating);
+	if (!search_lock(index, F_WRLCK)) {
+		pthread_mutex_unlock(&index->updating);
+		return (db_return){ .errno = DB_LOCK_FAIL };
+	}
+
+	// The bitmap of an interrupted update is not trusted, but its
+	// positions are all real occurrences, so they are kept. The lists may
+	// miss or repeat entries, so they are emptied.
+	bool synced = true;
+	if (header->updating) {
+		memset(index->indexed, 0, sizeof(uint64_t) * CEIL_DIV(header->blocks, WORD));
+		header->indexed = 0;
+
+		pthread_mutex_lock(&index->listing);
+		synced = lists_lock(index, F_WRLCK);
+		if (synced) {
+			lists_header(index)->count = 0;
+			lists_lock(index, F_UNLCK);
+		}
+		pthread_mutex_unlock(&index->listing);
+	}
+
+	header->updating = 1;
+	synced = msync(index->map, sizeof(index_t), MS_SYNC) == 0 && synced;
+
+	db_return ret = synced ? search_catch_up(index) : (db_return){ .errno = DB_LOCK_FAIL };
+	if (ret.errno == DB_SUCCESS)
+		__atomic_add_fetch(&header->indexed, ret.value.count, __ATOMIC_RELEASE);
+
+	// The positions, the bitmap and the lists reach the disk before the
+	// mark is cleared.
+	pthread_mutex_lock(&index->listing);
+	synced = synced
+		&& msync(index->map, index->length, MS_SYNC) == 0
+		&& msync(index->lists, index->lists_length, MS_SYNC) == 0;
+	pthread_mutex_unlock(&index->listing);
+	if (synced && ret.errno == DB_SUCCESS) {
+		__atomic_store_n(&header->updating, 0, __ATOMIC_RELEASE);
+		msync(index->map, sizeof(index_t), MS_SYNC);
+	}
+
+	search_lock(index, F_UNLCK);
+	pthread_mutex_unlock(&index->updating);
+
+	return ret;
+}
+
+/**
+ * @brief Compares two positions.
+ * @param a the first position
+ * @param b the second position
+ * @return the sign of a - b
+ */
+static int search_compare(const void * const a, const void * const b) {
+	const uint64_t x = *(const uint64_t *)a;
+	const uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * @brief Tells whether a pattern appears at a position.
+ * @param index the index
+ * @param position the position of the first digit, in digits
+ * @param pattern the digits of the pattern
+ * @param size the number of digits of the pattern
+ * @param blocks a buffer of CEIL_DIV(size + BLOCK_SIZE - 1, BLOCK_SIZE) blocks
+ * @param digits a buffer of their digits
+ * @return whether it appears, DB_SUCCESS being false if its blocks are not
+ * all computed
+ */
+static db_return search_at(
+		search * const index,
+		const uint64_t position,
+		const uint8_t * const pattern,
+		const uint64_t size,
+		uint64_t * const blocks,
+		uint8_t * const digits) {
+	const uint64_t first = position / BLOCK_SIZE;
+	const uint64_t count = CEIL_DIV(position % BLOCK_SIZE + size, BLOCK_SIZE);
+
+	db_return ret = db_read_range(index->db, first, count, blocks);
+	if (ret.errno == DB_READ_NOT_READY || ret.errno == DB_READ_OUT_OF_BOUNDS)
+		return (db_return){ .errno = DB_SUCCESS, .value = { .boolean = false } };
+
+	if (ret.errno != DB_SUCCESS)
+		return ret;
+
+	nibble_unpack(blocks, count, digits);
+	return (db_return){
+		.errno = DB_SUCCESS,
+		.value = { .boolean = memcmp(digits + position % BLOCK_SIZE, pattern, size) == 0 },
+	};
+}
+
+/**
+ * @brief Finds a pattern with the lists.
+ * @param index the index
+ * @param from the first position where the pattern may appear, in digits
+ * @param pattern the digits of the pattern, at least GRAMS + STEP - 1
+ * @param size the number of digits of the pattern
+ * @return the position of the first occurrence from the given position
+ */
+static db_return search_listed(
+		search * const index,
+		const uint64_t from,
+		const uint8_t * const pattern,
+		const uint64_t size) {
+	pthread_mutex_lock(&index->listing);
+	if (!lists_lock(index, F_RDLCK)) {
+		pthread_mutex_unlock(&index->listing);
+		return (db_return){ .errno = DB_LOCK_FAIL };
+	}
+
+	if (!lists_map(index, lists_total(lists_header(index)), false)) {
+		lists_lock(index, F_UNLCK);
+		pthread_mutex_unlock(&index->listing);
+		return (db_return){ .errno = DB_READ_CORRUPTED };
+	}
+
+	// An occurrence at a position p holds the listed substrings at the
+	// offsets k where p + k is a multiple of STEP. For each value of p
+	// modulo STEP, the rarest of them gives the candidates.
+	uint64_t offsets[STEP], grams[STEP], candidates = 0;
+	for (uint64_t m = 0; m < STEP; ++m) {
+		uint64_t rarest = UINT64_MAX;
+
+		for (uint64_t k = (STEP - m) % STEP, tried = 0; k + GRAMS <= size && tried < CHOICES; k += STEP, ++tried) {
+			uint64_t gram = 0;
+			for (uint64_t d = 0; d < GRAMS; ++d)
+				gram = (gram << NIBBLE) | pattern[k + d];
+
+			const uint64_t count = lists_count(index, gram);
+			if (count < rarest) {
+				rarest = count;
+				offsets[m] = k;
+				grams[m] = gram;
+			}
+		}
+
+		candidates += rarest;
+	}
+
+	uint64_t *positions = (uint64_t *)malloc(sizeof(uint64_t) * (candidates + 1));
+	uint64_t found = 0;
+
+	const lists_t * const header = lists_header(index);
+	const uint64_t *run = lists_entries(index);
+	for (uint64_t r = 0; positions != NULL && r < header->count; run += header->runs[r++])
+		for (uint64_t m = 0; m < STEP; ++m) {
+			const uint64_t key = grams[m] << POSITION_BITS;
+			const uint64_t end = lists_bound(run, header->runs[r], key | POSITION_MASK, true);
+
+			for (uint64_t e = lists_bound(run, header->runs[r], key, false); e < end; ++e) {
+				const uint64_t position = STEP * (run[e] & POSITION_MASK);
+				if (position >= offsets[m] && position - offsets[m] >= from)
+					positions[found++] = position - offsets[m];
+			}
+		}
+
+	lists_lock(index, F_UNLCK);
+	pthread_mutex_unlock(&index->listing);
+
+	const uint64_t count = CEIL_DIV(size + BLOCK_SIZE - 1, BLOCK_SIZE);
+	uint64_t *blocks = (uint64_t *)malloc(sizeof(uint64_t) * count);
+	uint8_t *digits = (uint8_t *)malloc(BLOCK_SIZE * count);
+	if (positions == NULL || blocks == NULL || digits == NULL) {
+		free(positions);
+		free(blocks);
+		free(digits);
+		return (db_return){ .errno = DB_READ_NOT_READY };
+	}
+
+	// The candidates are compared in order, so that the first match is the
+	// first occurrence.
+	qsort(positions, found, sizeof(uint64_t), search_compare);
+
+	db_return ret = { .errno = DB_READ_NOT_FOUND };
+	for (uint64_t k = 0; ret.errno == DB_READ_NOT_FOUND && k < found; ++k) {
+		if (k > 0 && positions[k] == positions[k - 1])
+			continue;
+
+		const db_return at = search_at(index, positions[k], pattern, size, blocks, digits);
+		if (at.errno != DB_SUCCESS)
+			ret = at;
+		else if (at.value.boolean)
+			ret = (db_return){
+				.errno = DB_SUCCESS,
+				.value = { .position = positions[k] },
+			};
+	}
+
+	free(positions);
+	free(blocks);
+	free(digits);
+	return ret;
+}
+
+db_return search_find(search * const index, const char * const hex) {
+	const uint64_t size = strlen(hex);
+	bool valid = size > 0;
+
+	for (uint64_t k = 0; valid && k < size; ++k)
+		valid = isxdigit((unsigned char)hex[k]);
+
+	if (!valid)
+		return (db_return){ .errno = DB_READ_INVALID };
+
+	db_return ret = search_update(index);
+	if (ret.errno != DB_SUCCESS)
+		return ret;
+
+	uint8_t *pattern = (uint8_t *)malloc(size);
+	if (pattern == NULL)
+		return (db_return){ .errno = DB_READ_NOT_READY };
+
+	for (uint64_t k = 0; k < size; ++k)
+		pattern[k] = isdigit((unsigned char)hex[k])
+			? hex[k] - '0'
+			: tolower((unsigned char)hex[k]) - 'a' + 10;
+
+	// A short pattern is looked up, and a long one cannot appear before any
+	// of its substrings, nor if one of them never appeared.
+	const uint64_t grams = size < GRAMS ? size : GRAMS;
+	uint64_t from = 0;
+	bool absent = false;
+
+	for (uint64_t k = 0; !absent && k + grams <= size; ++k) {
+		uint64_t gram = 0;
+		for (uint64_t d = 0; d < grams; ++d)
+			gram = (gram << NIBBLE) | pattern[k + d];
+
+		const uint64_t first = __atomic_load_n(search_entry(index, grams, gram), __ATOMIC_RELAXED);
+		absent = first == 0;
+
+		if (!absent && first - 1 >= k && first - 1 - k > from)
+			from = first - 1 - k;
+	}
+
+	if (absent)
+		ret = (db_return){ .errno = DB_READ_NOT_FOUND };
+	else if (size <= GRAMS)
+		ret = (db_return){
+			.errno = DB_SUCCESS,
+			.value = { .position = from },
+		};
+	else
+		ret = search_listed(index, from, pattern, size);
+
+	free(pattern);
+	return ret;
+}
@@ -0,0 +1,432 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shared.h"
+#include "database.h"
+#include "shard.h"
+
+/*
+ * The manifest is a 64-byte header followed by the path of each segment,
+ * in fixed-size entries padded with zeros. Segment i holds the blocks from
+ * i * blocks to (i + 1) * blocks, where blocks is in the header, at the
+ * same positions inside the segment minus i * blocks. A relative path is
+ * relative to the directory of the manifest, so that they can be moved
+ * together.
+ */
+
+/** The manifest magic number. */
+#define SHARD_MAGIC "PiSH\x24\x3F\x6A\x88"
+
+/** The manifest version. */
+#define SHARD_VERSION 1
+
+/** The size of a segment path inside the manifest, the final 0 included. */
+#define SHARD_PATH 256
+
+#pragma pack(push, 1)
+/** The manifest header. */
+typedef struct {
+	/// Manifest magic number.
+	uint8_t magic_number[8];
+
+	/// Manifest version.
+	uint8_t version;
+
+	/// Maximum number of digits of the whole database.
+	uint64_t max_digits;
+
+	/// Number of blocks of each segment, the last one excepted.
+	uint64_t blocks;
+
+	/// Number of segments.
+	uint64_t count;
+
+	/// Padding (reserved for future use).
+	uint8_t padding[31];
+} manifest_t;
+#pragma pack(pop)
+
+struct sharded_t {
+	/// Number of blocks of each segment, the last one excepted.
+	uint64_t blocks;
+
+	/// Number of blocks of the whole database.
+	uint64_t maximum_blocks;
+
+	/// Number of segments.
+	uint64_t count;
+
+	/// The segments.
+	database **segments;
+
+	/// The paths of the segments, kept by the segments while they are open.
+	char *paths;
+};
+
+bool shard_is_manifest(const uint8_t * const magic_number) {
+	return memcmp(magic_number, SHARD_MAGIC, 8) == 0;
+}
+
+/**
+ * @brief Resolves the path of a segment against the directory of the manifest.
+ * @param manifest the path of the manifest
+ * @param segment the path of the segment, as written in the manifest
+ * @param resolved the path of the segment, of strlen(manifest) +
+ * strlen(segment) + 1 bytes
+ */
+static void shard_resolve(const char * const manifest, const char * const segment, char * const resolved) {
+	const char * const slash = strrchr(manifest, '/');
+	const size_t prefix = segment[0] == '/' || slash == NULL ? 0 : (size_t)(slash - manifest) + 1;
+
+	memcpy(resolved, manifest, prefix);
+	strcpy(resolved + prefix, segment);
+}
+
+db_return shard_create(
+		const char * const path,
+		const uint64_t max_digits,
+		const char * const * const segments,
+		const uint64_t count) {
+	assert(max_digits > 0 && count > 0);
+
+	const uint64_t maximum_blocks = CEIL_DIV(max_digits, BLOCK_SIZE);
+	const uint64_t blocks = CEIL_DIV(maximum_blocks, count);
+
+	// Every segment must hold at least a block.
+	if (blocks * (count - 1) >= maximum_blocks)
+		return (db_return){ .errno = DB_OPEN_FAIL };
+
+	for (uint64_t s = 0; s < count; ++s) {
+		if (strlen(segments[s]) >= SHARD_PATH)
+			return (db_return){ .errno = DB_OPEN_FAIL };
+
+		const uint64_t first = blocks * s;
+		const uint64_t length = maximum_blocks - first < blocks ? maximum_blocks - first : blocks;
+
+		char segment[strlen(path) + strlen(segments[s]) + 1];
+		shard_resolve(path, segments[s], segment);
+
+		db_return create = db_create(segment, BLOCK_SIZE * length);
+		if (create.errno != DB_SUCCESS)
+			return create;
+	}
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL)
+		return (db_return){ .errno = DB_OPEN_FAIL };
+
+	manifest_t manifest = {
+		.magic_number = SHARD_MAGIC,
+		.version = SHARD_VERSION,
+		.max_digits = max_digits,
+		.blocks = blocks,
+		.count = count,
+		.padding = { 0 },
+	};
+
+	bool written = fwrite(&manifest, sizeof(manifest), 1, file) == 1;
+	for (uint64_t s = 0; written && s < count; ++s) {
+		char entry[SHARD_PATH] = { 0 };
+		strcpy(entry, segments[s]);
+		written = fwrite(entry, sizeof(entry), 1, file) == 1;
+	}
+
+	written &= fflush(file) == 0;
+	fclose(file);
+
+	if (!written)
+		return (db_return){ .errno = DB_OPEN_FAIL };
+
+	return (db_return){ .errno = DB_SUCCESS };
+}
+
+db_return shard_open(const char * const path, sharded ** const shards) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return (db_return){ .errno = DB_OPEN_FAIL };
+
+	manifest_t manifest;
+	if (fread(&manifest, sizeof(manifest), 1, file) != 1) {
+		fclose(file);
+		return (db_return){ .errno = DB_OPEN_FAIL };
+	}
+
+	if (!shard_is_manifest(manifest.magic_number)
+			|| manifest.version != SHARD_VERSION
+			|| manifest.count == 0
+			|| manifest.blocks == 0) {
+		fclose(file);
+		return (db_return){ .errno = DB_OPEN_WRONG_FORMAT };
+	}
+
+	// Each path is resolved behind the directory of the manifest.
+	const uint64_t stride = strlen(path) + SHARD_PATH;
+
+	sharded *s = (sharded *)malloc(sizeof(sharded));
+	database **segments = (database **)calloc(manifest.count, sizeof(database *));
+	char *paths = (char *)malloc(stride * manifest.count);
+
+	if (s == NULL || segments == NULL || paths == NULL) {
+		free(s);
+		free(segments);
+		free(paths);
+		fclose(file);
+		return (db_return){ .errno = DB_OPEN_FAIL };
+	}
+
+	s->blocks = manifest.blocks;
+	s->maximum_blocks = CEIL_DIV(manifest.max_digits, BLOCK_SIZE);
+	s->count = manifest.count;
+	s->segments = segments;
+	s->paths = paths;
+
+	db_return ret = { .errno = DB_SUCCESS };
+	for (uint64_t k = 0; k < s->count && ret.errno == DB_SUCCESS; ++k) {
+		char entry[SHARD_PATH];
+		if (fread(entry, SHARD_PATH, 1, file) != 1 || entry[SHARD_PATH - 1] != 0) {
+			ret.errno = DB_OPEN_WRONG_FORMAT;
+			break;
+		}
+
+		char * const segment = paths + stride * k;
+		shard_resolve(path, entry, segment);
+
+		ret = db_open(segment);
+		if (ret.errno == DB_SUCCESS)
+			segments[k] = ret.value.database;
+	}
+
+	fclose(file);
+
+	if (ret.errno != DB_SUCCESS) {
+		shard_close(s);
+		return ret;
+	}
+
+	*shards = s;
+	return (db_return){ .errno = DB_SUCCESS };
+}
+
+void shard_close(sharded * const shards) {
+	for (uint64_t k = 0; k < shards->count; ++k) {
+		if (shards->segments[k] != NULL)
+			db_close(shards->segments[k]);
+	}
+
+	free(shards->segments);
+	free(shards->paths);
+	free(shards);
+}
+
+/**
+ * @brief Splits a range at the end of its first segment.
+ * @param shards the sharded database
+ * @param first the position of the first block of the range
+ * @param count the number of blocks of the range
+ * @param segment the segment of the first block
+ * @param length the number of blocks of the range inside the segment
+ * @return the position of the first block inside the segment
+ */
+static inline uint64_t shard_split(
+		const sharded * const shards,
+		const uint64_t first,
+		const uint64_t count,
+		uint64_t * const segment,
+		uint64_t * const length) {
+	*segment = first / shards->blocks;
+
+	const uint64_t local = first % shards->blocks;
+	*length = shards->blocks - local < count ? shards->blocks - local : count;
+
+	return local;
+}
+
+db_return shard_read_position(sharded * const shards, const bool checked) {
+	// The segments are filled in order, so the first ones are usually full.
+	for (uint64_t k = 0; k < shards->count; ++k) {
+		db_return ret = checked
+			? db_read_unchecked(shards->segments[k])
+			: db_read_uncomputed(shards->segments[k]);
+
+		if (ret.errno == DB_SUCCESS) {
+			ret.value.position += shards->blocks * k;
+			return ret;
+		}
+
+		// Only a full segment lets us look at the next one.
+		if (ret.errno != (checked ? DB_READ_NO_UNCHECKED : DB_READ_NO_UNCOMPUTED))
+			return ret;
+	}
+
+	return (db_return){ .errno = checked ? DB_READ_NO_UNCHECKED : DB_READ_NO_UNCOMPUTED };
+}
+
+db_return shard_claim_uncomputed(sharded * const shards, const uint64_t count, const uint64_t ttl) {
+	for (uint64_t k = 0; k < shards->count; ++k) {
+		db_return ret = db_claim_uncomputed(shards->segments[k], count, ttl);
+
+		if (ret.errno == DB_SUCCESS) {
+			ret.value.range.position += shards->blocks * k;
+			return ret;
+		}
+
+		if (ret.errno != DB_READ_NO_UNCOMPUTED)
+			return ret;
+	}
+
+	return (db_return){ .errno = DB_READ_NO_UNCOMPUTED };
+}
+
+db_return shard_read_count(sharded * const shards, const bool checked) {
+	uint64_t count = 0;
+
+	for (uint64_t k = 0; k < shards->count; ++k)
+		count += (checked
+			? db_read_checked_count(shards->segments[k])
+			: db_read_computed_count(shards->segments[k])).value.count;
+
+	return (db_return){
+		.errno = DB_SUCCESS,
+		.value = { .count = count },
+	};
+}
+
+db_return shard_read_capacity(sharded * const shards) {
+	return (db_return){
+		.errno = DB_SUCCESS,
+		.value = { .count = shards->maximum_blocks },
+	};
+}
+
+db_return shard_read_computed_run(sharded * const shards, const uint64_t start) {
+	if (start >= shards->maximum_blocks)
+		return (db_return){ .errno = DB_READ_OUT_OF_BOUNDS };
+
+	// A run that ends with its segment goes on with the run at the start
+	// of the next segment, if any.
+	db_return run = { .errno = DB_READ_NOT_READY };
+
+	for (uint64_t k = start / shards->blocks; k < shards->count; ++k) {
+		const uint64_t base = shards->blocks * k;
+		const uint64_t local = run.errno == DB_SUCCESS || base > start ? 0 : start - base;
+
+		db_return ret = db_read_computed_run(shards->segments[k], local);
+		if (run.errno == DB_SUCCESS && (ret.errno != DB_SUCCESS || ret.value.range.position != 0))
+			break;
+
+		if (ret.errno != DB_SUCCESS)
+			continue;
+
+		if (run.errno == DB_SUCCESS)
+			run.value.range.count += ret.value.range.count;
+		else
+			run = (db_return){
+				.errno = DB_SUCCESS,
+				.value = { .range = { .position = base + ret.value.range.position, .count = ret.value.range.count } },
+			};
+
+		// The run stops inside this segment.
+		if (run.value.range.position + run.value.range.count < base + shards->blocks)
+			break;
+	}
+
+	return run;
+}
+
+db_return shard_scrub(sharded * const shards) {
+	for (uint64_t k = 0; k < shards->count; ++k) {
+		db_return ret = db_scrub(shards->segments[k]);
+
+		if (ret.errno != DB_SUCCESS) {
+			ret.value.position += shards->blocks * k;
+			return ret;
+		}
+	}
+
+	return (db_return){ .errno = DB_SUCCESS };
+}
+
+db_return shard_read_flag(sharded * const shards, const uint64_t position, const bool checked) {
+	if (position >= shards->maximum_blocks)
+		return (db_return){ .errno = DB_READ_OUT_OF_BOUNDS };
+
+	database * const segment = shards->segments[position / shards->blocks];
+	const uint64_t local = position % shards->blocks;
+
+	return checked
+		? db_read_is_checked(segment, local)
+		: db_read_is_computed(segment, local);
+}
+
+db_return shard_read_range(
+		sharded * const shards,
+		const uint64_t first,
+		const uint64_t count,
+		uint64_t * const out) {
+	if (count > shards->maximum_blocks || first > shards->maximum_blocks - count)
+		return (db_return){ .errno = DB_READ_OUT_OF_BOUNDS };
+
+	for (uint64_t done = 0; done < count;) {
+		uint64_t segment, length;
+		const uint64_t local = shard_split(shards, first + done, count - done, &segment, &length);
+
+		db_return ret = db_read_range(shards->segments[segment], local, length, out + done);
+		if (ret.errno != DB_SUCCESS)
+			return ret;
+
+		done += length;
+	}
+
+	return (db_return){ .errno = DB_SUCCESS };
+}
+
+db_return shard_write_range(
+		sharded * const shards,
+		const uint64_t first,
+		const uint64_t count,
+		const uint64_t * const digits) {
+	if (count > shards->maximum_blocks || first > shards->maximum_blocks - count)
+		return (db_return){ .errno = DB_WRITE_OUT_OF_BOUNDS };
+
+	for (uint64_t done = 0; done < count;) {
+		uint64_t segment, length;
+		const uint64_t local = shard_split(shards, first + done, count - done, &segment, &length);
+
+		db_return ret = db_write_range(shards->segments[segment], local, length, digits + done);
+		if (ret.errno != DB_SUCCESS) {
+			ret.value.count = done;
+			return ret;
+		}
+
+		done += length;
+	}
+
+	return (db_return){ .errno = DB_SUCCESS };
+}
+
+db_return shard_write_checked_range(
+		sharded * const shards,
+		const uint64_t first,
+		const uint64_t count) {
+	if (count > shards->maximum_blocks || first > shards->maximum_blocks - count)
+		return (db_return){ .errno = DB_WRITE_OUT_OF_BOUNDS };
+
+	for (uint64_t done = 0; done < count;) {
+		uint64_t segment, length;
+		const uint64_t local = shard_split(shards, first + done, count - done, &segment, &length);
+
+		db_return ret = db_write_checked_range(shards->segments[segment], local, length);
+		if (ret.errno != DB_SUCCESS) {
+			ret.value.count = done;
+			return ret;
+		}
+
+		done += length;
+	}
+
+	return (db_return){ .errno = DB_SUCCESS };
+}
@@ -0,0 +1,649 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "shared.h"
+#include "database.h"
+#include "nibble.h"
+#include "stats.h"
+
+/*
+ * The statistics are a 64-byte header, followed by a tree of tallies and by
+ * a bitmap of the blocks accounted for.
+ *
+ * The blocks are cut into ranges of RANGE_BLOCKS blocks, and the tally of
+ * each range is a leaf of the tree: the counts of its digits, and its runs
+ * that touch its bounds, so that the runs over several ranges are joined.
+ * Each node holds the tally of its two children. With n ranges, the leaves
+ * are the nodes n to 2n - 1, and any union of consecutive ranges is made
+ * of a logarithmic number of nodes.
+ *
+ * An update tallies again the whole ranges holding new blocks, and the
+ * nodes above them, inside a sequence lock: the readers copy the nodes they
+ * need without locking, and start again if an update went on meanwhile.
+ * As with the search index, an interrupted update is detected by a mark in
+ * the header, and then every range is tallied again.
+ */
+
+/** The statistics magic number. */
+#define STATS_MAGIC "PiST\x24\x3F\x6A\x88"
+
+/** The statistics version. */
+#define STATS_VERSION 1
+
+/** The number of blocks of a range. */
+#define RANGE_BLOCKS 1024
+
+/** The number of bits of a word of the bitmap. */
+#define WORD 64
+
+/** The number of digits read past a buffer by the run kernel. */
+#define PADDING 16
+
+#pragma pack(push, 1)
+/** The statistics header. */
+typedef struct {
+	/// Statistics magic number.
+	uint8_t magic_number[8];
+
+	/// Statistics version.
+	uint8_t version;
+
+	/// Whether an update may have been interrupted.
+	uint8_t updating;
+
+	/// Padding (reserved for future use).
+	uint8_t padding[30];
+
+	/// Sequence lock of the tree, odd while a node is written.
+	uint64_t sequence;
+
+	/// Number of blocks of the database.
+	uint64_t blocks;
+
+	/// Number of blocks accounted for.
+	uint64_t accounted;
+} header_t;
+#pragma pack(pop)
+
+/** The tally of consecutive digits. */
+typedef struct {
+	/// The number of occurrences of each digit.
+	uint64_t counts[RADIX];
+
+	/// The number of digits, computed or not.
+	uint64_t length;
+
+	/// The run starting with the first digit, empty if it is uncomputed.
+	stats_run head;
+
+	/// The run ending with the last digit, empty if it is uncomputed.
+	stats_run tail;
+
+	/// The first longest run.
+	stats_run longest;
+} tally_t;
+
+struct stats_t {
+	/// The database.
+	database *db;
+
+	/// The file descriptor of the statistics.
+	int fd;
+
+	/// The mapping of the statistics.
+	uint8_t *map;
+
+	/// The length of the mapping.
+	uint64_t length;
+
+	/// The number of ranges.
+	uint64_t ranges;
+
+	/// The nodes of the tree.
+	tally_t *tree;
+
+	/// The bitmap of the blocks accounted for.
+	uint64_t *accounted;
+
+	/// Serializes the updates between the threads.
+	pthread_mutex_t updating;
+};
+
+/**
+ * @brief Locks the statistics against the other processes.
+ * @param statistics the statistics
+ * @param type F_WRLCK or F_UNLCK
+ * @return whether the lock is held
+ */
+static bool stats_lock(const stats * const statistics, const short type) {
+	struct flock lock = {
+		.l_type = type,
+		.l_whence = SEEK_SET,
+		.l_start = 0,
+		.l_len = 0,
+	};
+
+	return fcntl(statistics->fd, F_OFD_SETLKW, &lock) != -1;
+}
+
+/**
+ * @brief Gets the header of the statistics.
+ * @param statistics the statistics
+ * @return the header, inside the mapping
+ */
+static inline header_t *stats_header(const stats * const statistics) {
+	return (header_t *)statistics->map;
+}
+
+/**
+ * @brief Ends the update of the tree a process died in, if any.
+ * @param header the header of the statistics, locked
+ *
+ * The sequence stays odd after such an update, and the readers would wait
+ * for it forever.
+ */
+static void stats_release(header_t * const header) {
+	const uint64_t sequence = __atomic_load_n(&header->sequence, __ATOMIC_RELAXED);
+	if (sequence % 2 != 0)
+		__atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Joins the tallies of consecutive digits.
+ * @param a the tally of the first digits
+ * @param b the tally of the digits right after them
+ * @return the tally of both
+ */
+static tally_t tally_join(const tally_t * const a, const tally_t * const b) {
+	if (a->length == 0)
+		return *b;
+
+	if (b->length == 0)
+		return *a;
+
+	tally_t tally = *a;
+	tally.length = a->length + b->length;
+	tally.tail = b->tail;
+
+	for (uint8_t d = 0; d < RADIX; ++d)
+		tally.counts[d] += b->counts[d];
+
+	// The run that ends a and the one that starts b make one run.
+	const bool joined = a->tail.length != 0 && b->head.length != 0 && a->tail.digit == b->head.digit;
+
+	if (joined && a->head.length == a->length)
+		tally.head.length += b->head.length;
+
+	if (joined && b->tail.length == b->length) {
+		tally.tail.position = a->tail.position;
+		tally.tail.length += a->tail.length;
+	}
+
+	if (joined && a->tail.length + b->head.length > tally.longest.length)
+		tally.longest = (stats_run){
+			.position = a->tail.position,
+			.length = a->tail.length + b->head.length,
+			.digit = a->tail.digit,
+		};
+
+	if (b->longest.length > tally.longest.length)
+		tally.longest = b->longest;
+
+	return tally;
+}
+
+/**
+ * @brief Tallies computed digits.
+ * @param digits the digits, readable PADDING bytes past their end
+ * @param length the number of digits, at least one
+ * @param position the position of the first digit
+ * @return the tally of the digits
+ */
+static tally_t tally_digits(const uint8_t * const digits, const uint64_t length, const uint64_t position) {
+	tally_t tally = { .length = length };
+	nibble_count(digits, length, tally.counts);
+
+	// The runs end where a digit differs from the next one, which is found
+	// 16 digits at a time. The last digit ends the last run.
+	uint64_t start = 0;
+
+	for (uint64_t k = 0; k < length; k += PADDING) {
+		uint32_t ends = 0;
+
+#if defined(__SSE2__)
+		const __m128i current = _mm_loadu_si128((const __m128i *)(digits + k));
+		const __m128i next = _mm_loadu_si128((const __m128i *)(digits + k + 1));
+		ends = ~_mm_movemask_epi8(_mm_cmpeq_epi8(current, next)) & 0xFFFF;
+#else
+		for (uint8_t j = 0; j < PADDING; ++j)
+			if (digits[k + j] != digits[k + j + 1])
+				ends |= 1U << j;
+#endif
+
+		if (length - k <= PADDING)
+			ends = (ends & ((2U << (length - k - 1)) - 1)) | 1U << (length - k - 1);
+
+		for (; ends != 0; ends &= ends - 1) {
+			const uint64_t end = k + __builtin_ctz(ends) + 1;
+			const stats_run run = {
+				.position = position + start,
+				.length = end - start,
+				.digit = digits[start],
+			};
+
+			if (start == 0)
+				tally.head = run;
+
+			if (run.length > tally.longest.length)
+				tally.longest = run;
+
+			tally.tail = run;
+			start = end;
+		}
+	}
+
+	return tally;
+}
+
+/**
+ * @brief Tallies consecutive blocks from the database.
+ * @param statistics the statistics
+ * @param first the first block
+ * @param end the block after the last one
+ * @param account whether to set the blocks read in the bitmap
+ * @param tally the tally of the blocks, the uncomputed ones included
+ * @param count the number of blocks newly accounted for
+ * @return only if the blocks could be read
+ */
+static db_return tally_blocks(
+		stats * const statistics,
+		const uint64_t first,
+		const uint64_t end,
+		const bool account,
+		tally_t * const tally,
+		uint64_t * const count) {
+	uint64_t *blocks = (uint64_t *)malloc(sizeof(uint64_t) * RANGE_BLOCKS);
+	uint8_t *digits = (uint8_t *)malloc(BLOCK_SIZE * RANGE_BLOCKS + PADDING);
+	if (blocks == NULL || digits == NULL) {
+		free(blocks);
+		free(digits);
+		return (db_return){ .errno = DB_READ_NOT_READY };
+	}
+
+	memset(digits, 0, BLOCK_SIZE * RANGE_BLOCKS + PADDING);
+	*tally = (tally_t){ 0 };
+	db_return ret = { .errno = DB_SUCCESS };
+
+	for (uint64_t k = first; ret.errno == DB_SUCCESS && k < end;) {
+		const db_return found = db_read_computed_run(statistics->db, k);
+		const uint64_t run = found.errno == DB_SUCCESS && found.value.range.position < end
+			? found.value.range.position
+			: end;
+
+		// The uncomputed blocks count as digits without any value, so that
+		// no run goes through them.
+		if (run > k) {
+			const tally_t gap = { .length = BLOCK_SIZE * (run - k) };
+			*tally = tally_join(tally, &gap);
+			k = run;
+			continue;
+		}
+
+		const uint64_t last = found.value.range.position + found.value.range.count;
+		const uint64_t stop = last < end && last - k < RANGE_BLOCKS
+			? last
+			: (end - k < RANGE_BLOCKS ? end : k + RANGE_BLOCKS);
+
+		ret = db_read_range(statistics->db, k, stop - k, blocks);
+		if (ret.errno != DB_SUCCESS)
+			break;
+
+		nibble_unpack(blocks, stop - k, digits);
+
+		const tally_t computed = tally_digits(digits, BLOCK_SIZE * (stop - k), BLOCK_SIZE * k);
+		*tally = tally_join(tally, &computed);
+
+		for (; account && k < stop; ++k) {
+			uint64_t * const word = &statistics->accounted[k / WORD];
+			const uint64_t bit = (uint64_t)1 << (k % WORD);
+
+			*count += (*word & bit) == 0;
+			*word |= bit;
+		}
+
+		k = stop;
+	}
+
+	free(blocks);
+	free(digits);
+	return ret;
+}
+
+db_return stats_open(database * const db, const char * const path, stats ** const statistics) {
+	const db_return capacity = db_read_capacity(db);
+	if (capacity.errno != DB_SUCCESS)
+		return capacity;
+
+	stats *s = (stats *)malloc(sizeof(stats));
+	if (s == NULL)
+		return (db_return){ .errno = DB_OPEN_FAIL };
+
+	s->db = db;
+	s->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (s->fd == -1) {
+		free(s);
+		return (db_return){ .errno = DB_OPEN_FAIL };
+	}
+
+	if (!stats_lock(s, F_WRLCK)) {
+		close(s->fd);
+		free(s);
+		return (db_return){ .errno = DB_LOCK_FAIL };
+	}
+
+	const uint64_t blocks = capacity.value.count;
+	s->ranges = CEIL_DIV(blocks, RANGE_BLOCKS);
+	s->length = sizeof(header_t)
+		+ sizeof(tally_t) * 2 * s->ranges
+		+ sizeof(uint64_t) * CEIL_DIV(blocks, WORD);
+
+	header_t header = { 0 };
+	struct stat st;
+	bool valid = fstat(s->fd, &st) == 0;
+	bool created = valid && st.st_size == 0;
+
+	if (valid && !created)
+		valid = pread(s->fd, &header, sizeof(header), 0) == sizeof(header);
+
+	db_error error = valid ? DB_SUCCESS : DB_OPEN_FAIL;
+	if (valid && !created
+			&& (memcmp(header.magic_number, STATS_MAGIC, 8) != 0 || header.version != STATS_VERSION))
+		error = DB_OPEN_WRONG_FORMAT;
+
+	// The tree depends on the number of blocks, so the statistics of a
+	// migrated database are started again.
+	if (error == DB_SUCCESS && !created && header.blocks != blocks) {
+		created = true;
+		if (ftruncate(s->fd, 0) != 0)
+			error = DB_OPEN_FAIL;
+	}
+
+	if (error == DB_SUCCESS && ftruncate(s->fd, s->length) != 0)
+		error = DB_OPEN_FAIL;
+
+	s->map = MAP_FAILED;
+	if (error == DB_SUCCESS)
+		s->map = (uint8_t *)mmap(NULL, s->length, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+
+	if (error == DB_SUCCESS && s->map == MAP_FAILED)
+		error = DB_OPEN_FAIL;
+
+	if (error != DB_SUCCESS) {
+		stats_lock(s, F_UNLCK);
+		close(s->fd);
+		free(s);
+		return (db_return){ .errno = error };
+	}
+
+	if (created) {
+		header = (header_t){ .magic_number = STATS_MAGIC, .version = STATS_VERSION, .blocks = blocks };
+		memcpy(s->map, &header, sizeof(header));
+	}
+
+	stats_release(stats_header(s));
+
+	stats_lock(s, F_UNLCK);
+
+	s->tree = (tally_t *)(s->map + sizeof(header_t));
+	s->accounted = (uint64_t *)(s->tree + 2 * s->ranges);
+	pthread_mutex_init(&s->updating, NULL);
+
+	*statistics = s;
+	return (db_return){ .errno = DB_SUCCESS };
+}
+
+void stats_close(stats * const statistics) {
+	munmap(statistics->map, statistics->length);
+	close(statistics->fd);
+	pthread_mutex_destroy(&statistics->updating);
+	free(statistics);
+}
+
+/**
+ * @brief Tallies a range again, and the nodes above it.
+ * @param statistics the statistics, locked
+ * @param range the index of the range
+ * @param count the number of blocks newly accounted for
+ * @return only if the blocks could be read
+ */
+static db_return stats_range(stats * const statistics, const uint64_t range, uint64_t * const count) {
+	header_t * const header = stats_header(statistics);
+	const uint64_t first = RANGE_BLOCKS * range;
+	const uint64_t end = header->blocks - first < RANGE_BLOCKS ? header->blocks : first + RANGE_BLOCKS;
+
+	tally_t tally;
+	db_return ret = tally_blocks(statistics, first, end, true, &tally, count);
+	if (ret.errno != DB_SUCCESS)
+		return ret;
+
+	// The sequence is made odd even if it already is, so that it is even
+	// again once the nodes are written.
+	uint64_t * const sequence = &header->sequence;
+	const uint64_t odd = __atomic_load_n(sequence, __ATOMIC_RELAXED) | 1;
+	__atomic_store_n(sequence, odd, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	uint64_t node = statistics->ranges + range;
+	statistics->tree[node] = tally;
+
+	for (node /= 2; node >= 1; node /= 2)
+		statistics->tree[node] = tally_join(&statistics->tree[2 * node], &statistics->tree[2 * node + 1]);
+
+	__atomic_store_n(sequence, odd + 1, __ATOMIC_RELEASE);
+	return ret;
+}
+
+/**
+ * @brief Finds the first block not accounted for.
+ * @param statistics the statistics
+ * @param from the first block to test
+ * @param end the block after the last one to test
+ * @return the first block not accounted for, or end
+ */
+static uint64_t stats_next(const stats * const statistics, const uint64_t from, const uint64_t end) {
+	for (uint64_t k = from; k < end;) {
+		const uint64_t word = ~statistics->accounted[k / WORD] & (~(uint64_t)0 << (k % WORD));
+
+		if (word != 0) {
+			const uint64_t found = k - k % WORD + __builtin_ctzll(word);
+			return found < end ? found : end;
+		}
+
+		k += WORD - k % WORD;
+	}
+
+	return end;
+}
+
+/**
+ * @brief Tallies again the ranges holding blocks not accounted for.
+ * @param statistics the statistics, locked
+ * @return the number of blocks newly accounted for
+ */
+static db_return stats_catch_up(stats * const statistics) {
+	const header_t * const header = stats_header(statistics);
+	db_return ret = { .errno = DB_SUCCESS };
+	uint64_t count = 0;
+
+	for (uint64_t start = 0; ret.errno == DB_SUCCESS && start < header->blocks;) {
+		const db_return found = db_read_computed_run(statistics->db, start);
+		if (found.errno != DB_SUCCESS)
+			break;
+
+		const uint64_t end = found.value.range.position + found.value.range.count;
+		const uint64_t k = stats_next(statistics, found.value.range.position, end);
+
+		if (k >= end) {
+			start = end;
+			continue;
+		}
+
+		ret = stats_range(statistics, k / RANGE_BLOCKS, &count);
+		start = RANGE_BLOCKS * (k / RANGE_BLOCKS + 1);
+	}
+
+	if (ret.errno != DB_SUCCESS)
+		return ret;
+
+	return (db_return){
+		.errno = DB_SUCCESS,
+		.value = { .count = count },
+	};
+}
+
+db_return stats_update(stats * const statistics) {
+	header_t * const header = stats_header(statistics);
+	const uint64_t computed = db_read_computed_count(statistics->db).value.count;
+
+	// The blocks accounted for are computed, so there is nothing new when
+	// there are as many of them.
+	if (!__atomic_load_n(&header->updating, __ATOMIC_ACQUIRE)
+			&& __atomic_load_n(&header->accounted, __ATOMIC_ACQUIRE) == computed)
+		return (db_return){ .errno = DB_SUCCESS, .value = { .count = 0 } };
+
+	pthread_mutex_lock(&statistics->updating);
+	if (!stats_lock(statistics, F_WRLCK)) {
+		pthread_mutex_unlock(&statistics->updating);
+		return (db_return){ .errno = DB_LOCK_FAIL };
+	}
+
+	// The tallies of an interrupted update may lag behind its bitmap.
+	if (header->updating) {
+		memset(statistics->accounted, 0, sizeof(uint64_t) * CEIL_DIV(header->blocks, WORD));
+		header->accounted = 0;
+		stats_release(header);
+	}
+
+	header->updating = 1;
+	bool synced = msync(statistics->map, sizeof(header_t), MS_SYNC) == 0;
+
+	db_return ret = stats_catch_up(statistics);
+	if (ret.errno == DB_SUCCESS)
+		__atomic_add_fetch(&header->accounted, ret.value.count, __ATOMIC_RELEASE);
+
+	synced = synced && msync(statistics->map, statistics->length, MS_SYNC) == 0;
+	if (synced && ret.errno == DB_SUCCESS) {
+		__atomic_store_n(&header->updating, 0, __ATOMIC_RELEASE);
+		msync(statistics->map, sizeof(header_t), MS_SYNC);
+	}
+
+	stats_lock(statistics, F_UNLCK);
+	pthread_mutex_unlock(&statistics->updating);
+
+	return ret;
+}
+
+/**
+ * @brief Joins the tallies of consecutive ranges from the tree.
+ * @param statistics the statistics
+ * @param first the first range
+ * @param end the range after the last one
+ * @return the tally of the ranges
+ */
+static tally_t stats_tree(const stats * const statistics, const uint64_t first, const uint64_t end) {
+	const uint64_t * const sequence = &stats_header(statistics)->sequence;
+
+	for (;;) {
+		const uint64_t before = __atomic_load_n(sequence, __ATOMIC_ACQUIRE);
+		if (before % 2 != 0)
+			continue;
+
+		// The nodes on the left are joined from the left, and the ones on
+		// the right from the right.
+		tally_t left = { 0 };
+		tally_t right = { 0 };
+
+		for (uint64_t l = first + statistics->ranges, r = end + statistics->ranges; l < r; l /= 2, r /= 2) {
+			if (l % 2 != 0) {
+				const tally_t node = statistics->tree[l++];
+				left = tally_join(&left, &node);
+			}
+
+			if (r % 2 != 0) {
+				const tally_t node = statistics->tree[--r];
+				right = tally_join(&node, &right);
+			}
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(sequence, __ATOMIC_RELAXED) == before)
+			return tally_join(&left, &right);
+	}
+}
+
+db_return stats_read(
+		stats * const statistics,
+		const uint64_t first,
+		const uint64_t count,
+		stats_digits * const out) {
+	const uint64_t blocks = stats_header(statistics)->blocks;
+	if (count > blocks || first > blocks - count)
+		return (db_return){ .errno = DB_READ_OUT_OF_BOUNDS };
+
+	db_return ret = stats_update(statistics);
+	if (ret.errno != DB_SUCCESS)
+		return ret;
+
+	// The whole ranges come from the tree, and the blocks before and after
+	// them from the database.
+	const uint64_t end = first + count;
+	uint64_t low = CEIL_DIV(first, RANGE_BLOCKS);
+	uint64_t high = end / RANGE_BLOCKS;
+	if (low > high)
+		low = high = first / RANGE_BLOCKS;
+
+	tally_t before = { 0 }, after = { 0 }, tally = { 0 };
+	uint64_t unused = 0;
+
+	if (low == high)
+		ret = tally_blocks(statistics, first, end, false, &tally, &unused);
+	else {
+		ret = tally_blocks(statistics, first, RANGE_BLOCKS * low, false, &before, &unused);
+
+		if (ret.errno == DB_SUCCESS)
+			ret = tally_blocks(statistics, RANGE_BLOCKS * high, end, false, &after, &unused);
+
+		const tally_t middle = stats_tree(statistics, low, high);
+		tally = tally_join(&before, &middle);
+		tally = tally_join(&tally, &after);
+	}
+
+	if (ret.errno != DB_SUCCESS)
+		return ret;
+
+	*out = (stats_digits){ .longest = tally.longest };
+
+	for (uint8_t d = 0; d < RADIX; ++d) {
+		out->counts[d] = tally.counts[d];
+		out->digits += tally.counts[d];
+	}
+
+	const double expected = (double)out->digits / RADIX;
+	for (uint8_t d = 0; expected > 0 && d < RADIX; ++d)
+		out->chi_square += ((double)out->counts[d] - expected) * ((double)out->counts[d] - expected) / expected;
+
+	return (db_return){ .errno = DB_SUCCESS };
+}